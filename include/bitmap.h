@@ -23,6 +23,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <zlib.h>
 #include "pauls.h"
 
 #ifndef BITMAPLIB_H
@@ -52,6 +53,75 @@ typedef struct {
    char  imagedescriptor;
 } TGAHEADER;
 
+/* Parallel compressed TGA encoding, see WriteTGACompressedRows */
+typedef struct {
+	BITMAP4 *bm;
+	int nx,ny;
+	int depth;
+	int flip;
+	long rowsize;
+	unsigned char *buffer;
+	int *length;
+} TGAROWS;
+
+/* Parallel PNG filtering, see WritePNG */
+typedef struct {
+	BITMAP4 *bm;
+	int nx,ny;
+	int depth;
+	int flip;
+	long rowsize;
+	unsigned char *previous;
+	unsigned char *buffer;
+} PNGROWS;
+
+/* A bitmap being written a block of rows at a time */
+typedef struct {
+	FILE *fptr;
+	int nx,ny;
+	int format;
+	int linelength;
+	unsigned char *row;
+	int depth;
+	int firstrow;
+	unsigned char *previous;
+	z_stream z;
+	unsigned char *zbuffer;
+} BITMAPSTREAM;
+
+#define PNGCHUNKSIZE 262144
+
+/* Parallel conversion to YUV 4:2:0, see Bitmap_to_YUV420 */
+typedef struct {
+	BITMAP4 *bm;
+	int nx,ny;
+	int flip;
+	unsigned char *yuv;
+} YUVROWS;
+
+/* Weights of a separable scale along one axis, ntaps per output sample */
+typedef struct {
+	int n;
+	int ntaps;
+	int *index;
+	float *weight;
+} SCALETABLE;
+
+/* The two passes of SeparableScale */
+typedef struct {
+	BITMAP4 *bm_in;
+	int nx,ny;
+	BITMAP4 *bm_out;
+	int nnx,nny;
+	SCALETABLE *across,*down;
+	float *work;
+} SCALEPASS;
+
+#define SCALECLAMP(i,n) ((i) < 0 ? 0 : ((i) >= (n) ? (n)-1 : (i)))
+
+/* Largest run length encoded TGA row, every packet a single pixel */
+#define TGAROWSIZE(width,depth) ((long)(width) * ((depth) + 1))
+
 BITMAP4 *Create_Bitmap(int,int);
 void Destroy_Bitmap(BITMAP4 *);
 void Write_Bitmap(FILE *,BITMAP4 *,int,int,int);
@@ -59,6 +129,13 @@ void Erase_Bitmap(BITMAP4 *,int,int,BITMAP4);
 void GaussianScale(BITMAP4 *,int,int,BITMAP4 *,int,int,double);
 void BiCubicScale(BITMAP4 *,int,int,BITMAP4 *,int,int);
 double BiCubicR(double);
+SCALETABLE *BiCubicTable(int,int);
+SCALETABLE *GaussianTable(int,int,double);
+SCALETABLE *Create_ScaleTable(int,int);
+void Destroy_ScaleTable(SCALETABLE *);
+void SeparableScale(BITMAP4 *,int,int,BITMAP4 *,int,int,SCALETABLE *,SCALETABLE *);
+void ScaleAcross(int,int,void *);
+void ScaleDown(int,int,void *);
 int Draw_Pixel(BITMAP4 *,int,int,int,int,BITMAP4);
 BITMAP4 Get_Pixel(BITMAP4 *,int,int,int,int);
 void Draw_Line(BITMAP4 *,int,int,int,int,int,int,BITMAP4);
@@ -66,6 +143,20 @@ BITMAP4 Scale_Pixel(BITMAP4,double);
 void Flip_Bitmap(BITMAP4 *,int,int,int);
 int Same_BitmapPixel(BITMAP4,BITMAP4);
 BITMAP4 YUV_to_Bitmap(int,int,int);
+void Bitmap_to_YUV420(BITMAP4 *,int,int,unsigned char *,int);
+void YUV420Rows(int,int,void *);
+
+int Open_BitmapStream(BITMAPSTREAM *,FILE *,int,int,int);
+void Write_BitmapStream(BITMAPSTREAM *,BITMAP4 *,int);
+void Close_BitmapStream(BITMAPSTREAM *);
+
+int PNG_OpenStream(BITMAPSTREAM *);
+void PNG_WriteStream(BITMAPSTREAM *,BITMAP4 *,int);
+void PNG_Deflate(BITMAPSTREAM *,unsigned char *,long,int);
+void PNG_CloseStream(BITMAPSTREAM *);
+void FilterPNGRows(int,int,void *);
+void PNG_WriteChunk(FILE *,char *,unsigned char *,long);
+void PNG_PutLong(unsigned char *,unsigned long);
 
 void BM_WriteLongInt(FILE *,char *,long);
 void BM_WriteHexString(FILE *,char *);
@@ -74,5 +165,8 @@ void TGA_Info(FILE *,int *,int *,int *);
 int TGA_Read(FILE *,BITMAP4 *,int *,int *);
 void TGA_MergeBytes(BITMAP4 *,unsigned char *,int);
 void WriteTGACompressedRow(FILE *,BITMAP4 *,int,int);
+int EncodeTGACompressedRow(unsigned char *,BITMAP4 *,int,int);
+void EncodeTGACompressedRows(int,int,void *);
+void WriteTGACompressedRows(FILE *,BITMAP4 *,int,int,int,int);
 
 #endif /* BITMAPLIB_H */
@@ -29,13 +29,41 @@ char *optionstring = "Options\n\
    -cs i                        Colour scheme\n\
    -circo                       Layout the vertices in a circle\n\
    -fdp                         Use the Fruchterman-Reingold force-based graph layout algorithm\n\
+   -multilevel                  Use the native multilevel force-directed layout, for large graphs\n\
+   -spectral                    Lay out from the 2nd and 3rd Laplacian eigenvectors, for large or regular graphs\n\
+   -localradius                 Size each vertex by the distance to its nearest neighbour\n\
    -tiff                        Change image export format to TIFF\n\
+   -png                         Change image export format to PNG\n\
+   -y4m file                    Record to one YUV4MPEG2 video stream, - for stdout\n\
+   -offscreen WxH               Render every time step to image files, no window needed\n\
+   -supersample int             Render offscreen this many times larger and scale down\n\
+   -poster WxH [int]            Render one image of any size in tiles [time step, default last]\n\
+   -threads int                 Number of worker threads (default: one per processor)\n\
+   -bench                       Time the image writer (with -offscreen) or the layouts and walk and exit\n\
+   -nocache                     Always lay out the graph and compute the walk, do not read or\n\
+                                write the cache of layouts and walks\n\
+   -cachedir dir                Keep cached layouts and walks in dir\n\
+                                (default: $QWVIZ_CACHE or ~/.cache/qwViz)\n\
+   -cachelimit MB               Keep at most MB of cached walks, removing the least recently\n\
+                                used first; larger walks are not cached (default 1024, 0 for none)\n\
    -i [int]                     Linearly interpolate probability distribution [smoothness]\n\
 \n\
 Quantum walk options (.adj input required)\n\
    -start [int]                 Quantum walk starting from vertex [start position]\n\
    -search [int]                Quantum-walk-based search procedure [marked vertex]\n\
    -steps [int]                 [Number] of steps in the walk\n\
+   -stride [int]                Store the probabilities only every [int] steps, for long walks\n\
+   -sweep all|list              Search for each marked vertex in turn, e.g. -sweep 1,5,10-20,\n\
+                                and print the peak probability and its step\n\
+   -startsweep all|list         Walk from each start vertex in turn and print the mean and peak\n\
+                                return probability, with -o x.prob also write x_<start>.prob\n\
+   -symmetry                    Walk on the quotient by the symmetry of the start or marked\n\
+                                vertex, much faster on trees and other symmetric graphs\n\
+   -reorder                     Renumber the vertices (reverse Cuthill-McKee) for the walk,\n\
+                                output keeps the numbers of the .adj file\n\
+   -checkpoint [int]            Save the walk to file.adj.ckpt every [int] steps and at the end\n\
+   -resume                      Carry on from file.adj.ckpt, also to extend a finished walk\n\
+   -renormalise                 Scale the state back to norm 1 when it drifts by more than 1e-12\n\
    -o [char]                    Write data to a file, .qwml or .prob extension determines output format\n\
 ";
 
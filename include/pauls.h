@@ -30,6 +30,7 @@
 #include <sys/resource.h>
 #include <termios.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #define ABS(x) (x < 0 ? -(x) : (x))
 #define CROSSPROD(p1,p2,p3) \
@@ -109,7 +110,23 @@ typedef struct {
 	PANELITEM *items;
 } PANEL;
 
+#define PARALLELMAX 64
+
+typedef struct {
+	void (*func)(int,int,void *);
+	int start,end;
+	void *arg;
+} PARALLELTASK;
+
+void SetParallelThreads(int);
+int GetParallelThreads(void);
+void MarkParallelWorker(void);
+void ParallelFor(int,void (*)(int,int,void *),void *);
+
 int WindowDump(char *,int,int,int,int);
+int FirstFreeImage(char *,int,char *);
+int FirstFreeFrame(int,int,char *);
+int ImageExists(char *,int,char *);
 void CreateDisk(XYZ,XYZ,double,double,int,double,double);
 void CreateCone(XYZ,XYZ,double,double,int,double,double);
 void DrawGLText(int,int,char *);
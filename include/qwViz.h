@@ -25,7 +25,9 @@
 #include <math.h>
 #include <gvc.h>
 #include <ctype.h>
+#include <pthread.h>
 #if defined(__linux__)
+#define GL_GLEXT_PROTOTYPES
 #include <GL/glut.h>
 #elif defined(__APPLE__)
 #include <GLUT/glut.h>
@@ -56,6 +58,8 @@ typedef struct {
   int record;            /** Movie recording mode     */
   int windowdump;        /** Image recording modes    */
   int exporttiff;        /** Export Tiff              */
+  int exportpng;         /** Export PNG               */
+  char streamname[256];  /** Y4M stream, - for stdout */
   int fullscreen;        /** Game mode or not         */
   double targetfps;      /** Target frame rate        */
   int rendermode;        /** Shading type             */
@@ -69,6 +73,18 @@ typedef struct {
   int labelledvertex;
   int subframes;
   int colourscheme;
+  int offscreen;         /** Render to files without a window */
+  int threads;           /** Worker threads               */
+  int supersample;       /** Offscreen render scale       */
+  int poster;            /** Render one tiled image       */
+  int posterwidth;
+  int posterheight;
+  int postertime;        /** Time step, -1 for the last   */
+  int bench;             /** Print timings and exit       */
+  int cache;             /** Use the layout cache         */
+  char cachedir[256];    /** Where the cache files are    */
+  int cachelimit;        /** MB of cached walks kept      */
+  int localradius;       /** Size each vertex separately  */
 } OPTIONS;
 
 typedef struct {
@@ -92,11 +108,86 @@ typedef struct {
   int graphvizlayout;
   char* layoutalgorithm; 
   int firstrender;
+  int *nbrstart;         /** Neighbours of i are nbr[nbrstart[i]] to  */
+  int *nbr;              /** nbr[nbrstart[i+1]-1], NULL until built   */
+  int *reverse;          /** Arc j->i of the arc nbr[a] = j from i    */
+  float *radiusscale;    /** Radius of each vertex over noderadius,   */
+                         /** NULL unless -localradius               */
+  int *order;            /** File number of vertex i while reordered, */
+                         /** see qw_reorder.c, otherwise NULL       */
 } GRAPH;
 
+/** One level of MultilevelLayout, each vertex a cluster of the finer */
+typedef struct {
+  int n;
+  int *nbrstart;
+  int *nbr;
+  double *mass;          /** Vertices of the finest level it holds    */
+  int *coarse;           /** Vertex of the next coarser level         */
+  double *x;
+  double *y;
+} LAYOUTLEVEL;
+
+/** Shared state of one force iteration, see ComputeForces */
+typedef struct {
+  LAYOUTLEVEL *level;
+  double k;              /** Natural edge length                      */
+  double cutoff;         /** Range of the repulsion                   */
+  double xmin, ymin;
+  double cellsize;
+  int gridx, gridy;
+  int *cellstart;        /** Vertices in each cell of the grid        */
+  int *cellvertex;
+  double *fx;
+  double *fy;
+} FORCEPASS;
+
+/** Arguments of NearestNeighbourRows */
+typedef struct {
+  LAYOUTLEVEL points;    /** Only n, x and y are used                 */
+  FORCEPASS grid;        /** Only the grid is used                    */
+  double maxdist;
+  double *nn;
+} NEARESTPASS;
+
+/** Start of a layout cache file, see qw_layoutcache.c */
+typedef struct {
+  char magic[8];         /** QWLAYOUTMAGIC                            */
+  int version;
+  int nodes;
+  unsigned long long hash;
+  double noderadius;
+} LAYOUTCACHEHEADER;
+
+/** A layout running on a worker thread, see qw_layoutthread.c */
+typedef struct {
+  int active;            /** Worker started and not yet joined        */
+  pthread_t thread;
+  pthread_mutex_t lock;  /** Guards x, y, version and finished        */
+  GRAPH graph;           /** The worker's copy of the graph           */
+  double *x;             /** Latest published scaled coordinates      */
+  double *y;
+  int version;           /** Counts publications                      */
+  int finished;
+  double *targetx;       /** What the display is moving towards       */
+  double *targety;
+  int shown;             /** version of targetx and targety           */
+  double tstart;
+} LAYOUTPROGRESS;
+
+/** Arguments of LaplacianRows */
+typedef struct {
+  LAYOUTLEVEL *level;
+  double *in;            /** ncols columns, each level->n long        */
+  double *out;
+  int ncols;
+} SPECTRALPASS;
+
 typedef struct {
   int compute;
-  int steps;
+  int steps;             /** Probabilities stored for each vertex     */
+  int stride;            /** Walk steps between them, -stride         */
+  int walksteps;         /** Walk steps asked for with -steps         */
   double **prob;
   char* comment;
   float maxprob;
@@ -108,8 +199,103 @@ typedef struct {
   int marked;
   int start;
   int write;
+  char *sweep;           /** -sweep list of marked vertices, or NULL  */
+  char *startsweep;      /** -startsweep list of start vertices       */
+  int symmetry;          /** -symmetry, walk on the quotient graph    */
+  int reorder;           /** -reorder, renumber the vertices first    */
+  int checkpoint;        /** -checkpoint interval in steps, or 0      */
+  int resume;            /** -resume from the checkpoint              */
+  int renormalise;       /** -renormalise the state when it drifts    */
+  char checkpointfile[512]; /** The .adj file name with .ckpt added   */
 } QWPARAM;
 
+/** How far the norm of the walk has drifted from 1, see CheckNorm */
+typedef struct {
+  int checks;
+  double largest;        /** Largest |norm - 1| seen                  */
+  int largeststep;
+  double last;           /** norm - 1 at the last check               */
+  int renormalised;      /** Times the state was scaled back to 1     */
+} NORMDRIFT;
+
+/** The start of a checkpoint file, see qw_checkpoint.c */
+typedef struct {
+  char magic[8];
+  int version;
+  int nodes;
+  unsigned long long hash; /** GraphHash of the graph walked on       */
+  int arcs;
+  int procedure;
+  int start;
+  int marked;
+  int stride;            /** Steps between saved probabilities        */
+  int steps;             /** Steps taken                              */
+} CHECKPOINTHEADER;
+
+/** The searches of a sweep, see qw_sweep.c */
+typedef struct {
+  GRAPH *graph;
+  int steps;
+  int count;
+  int *marked;           /** Marked vertex of each search             */
+  double *peak;          /** Highest probability at the marked vertex */
+  int *peaktime;         /** First step at which it is reached        */
+} SWEEPPASS;
+
+/** The walks of a start sweep, see qw_sweep.c */
+typedef struct {
+  GRAPH *graph;
+  int steps;             /** Walk steps                               */
+  int stride;            /** Walk steps between rows of the .prob     */
+  int count;
+  int *start;            /** Start vertex of each walk                */
+  int *listed;           /** The same, numbered as in the file        */
+  int *position;         /** Vertex of the graph for each file vertex */
+  char *out;             /** .prob file name to number, or NULL       */
+  double *mean;          /** Time-averaged probability at the start   */
+  double *peak;          /** Highest return probability after step 0  */
+  int *peaktime;         /** First step at which it is reached        */
+} STARTPASS;
+
+/** The quotient of a graph by an equitable partition, see qw_quotient.c */
+typedef struct {
+  int cells;
+  int arcs;              /** Pairs of adjacent cells A -> B           */
+  int *degree;           /** Degree of the vertices of each cell      */
+  int *start;            /** Arcs of cell A are start[A] to start[A+1]-1 */
+  int *nbr;              /** Cell B of each arc, in order             */
+  int *count;            /** b_AB, neighbours in B of a vertex of A   */
+  int *reverse;          /** The arc B -> A                           */
+} QUOTIENT;
+
+/** A least recently used cache, see StepCacheMisses */
+#define CACHELINE      64
+#define CACHESETS      64
+#define CACHEWAYS      8
+typedef struct {
+  unsigned long tag[CACHESETS][CACHEWAYS];
+  long used[CACHESETS][CACHEWAYS]; /** Time of last use, 0 if empty */
+  long clock;
+  long misses;
+} CACHEMODEL;
+
+/** WALKLANES walks on one graph, see qw_batch.c */
+#define WALKLANES      8          /** Walks per batch, a multiple of the widest vector */
+typedef struct {
+  GRAPH *graph;
+  double *amp;           /** amp[a*WALKLANES + k], arc a of walk k    */
+  double *next;          /** Scratch for the shift                    */
+  int marked[WALKLANES]; /** Marked vertex of each walk, or -1        */
+} WALKBATCH;
+
+/** The batched kernels are built for each vector width where the
+    loader can pick between them */
+#if defined(__GNUC__) && defined(__x86_64__) && defined(__linux__) && !defined(__clang__)
+#define WALKKERNEL __attribute__((target_clones("avx512f","avx2","default")))
+#else
+#define WALKKERNEL
+#endif
+
 typedef struct {
   char* in;
   FILE* fpin;
@@ -119,10 +305,97 @@ typedef struct {
   char outtype;
 } QWFILE;
 
+#define GLSTATECAPS 4
+
+typedef struct {
+  int enabled[GLSTATECAPS]; /** Shadow state, -1 if unknown      */
+  int issued;               /** Enable/disable calls this frame  */
+  int skipped;              /** Redundant calls skipped          */
+  int lastissued;           /** Counts for the last whole frame  */
+  int lastskipped;
+} GLSTATE;
+
+#define FORCELEVELS    40         /** Most levels of MultilevelLayout           */
+#define FORCECOARSEST  16         /** Stop coarsening at this many vertices     */
+#define FORCECOARSEITER 600       /** Force iterations on the coarsest level    */
+#define FORCEFINEITER  150        /** Force iterations on the other levels      */
+#define FORCEGRIDMAX   1024       /** Most grid cells along each side           */
+#define SPECTRALBLOCK  3          /** Eigenvectors LOBPCG iterates together     */
+#define SPECTRALCOARSEITER 500    /** LOBPCG iterations on the coarsest level   */
+#define SPECTRALFINEITER 200      /** LOBPCG iterations on the other levels     */
+#define SPECTRALTOL    1e-3       /** Relative residual of a converged vector   */
+#define QWLAYOUTMAGIC  "QWLAYOUT"
+#define NODERADIUSMIN  0.015
+#define NODERADIUSMAX  0.05
+#define LAYOUTEASE     0.15       /** Fraction of the way moved each frame      */
+#define QWLAYOUTVERSION 1
+#define QWCKPTMAGIC    "QWCHKPNT"
+#define QWCKPTVERSION  2
+#define QWCOIN         "grover"   /** The coin, part of the walk cache key     */
+#define QWCACHELIMIT   1024       /** Default -cachelimit, MB of cached walks  */
+#define QWNORMTOLERANCE 1e-12     /** Drift of the norm that -renormalise fixes */
+#define QWHASHBASIS    14695981039346656037ULL /** 64 bit FNV-1a      */
+#define QWHASHPRIME    1099511628211ULL
+#define POSTERTILE     2048       /** Largest tile of a TiledScreenshot         */
+#define RECORDPBOS     4          /** Readbacks in flight, two frames in stereo */
+#define RECORDIMAGES   16         /** Image buffers shared with the encoders    */
+#define RECORDENCODERS 8          /** Most encoder threads                      */
+#define RECORDBUFSIZE  (1 << 20)  /** stdio buffer of each file being written   */
+
+typedef struct {
+  BITMAP4 *image;
+  int width;
+  int height;
+  int format;            /** Write_Bitmap format      */
+  char fname[64];
+  int sequence;          /** Place in the stream, -1 for a file */
+  int supersample;       /** Scale down by this before writing  */
+} RECORDFRAME;
+
+typedef struct {
+  int active;
+  GLenum readbuffer[2];  /** Buffers read for each eye              */
+  int findfree;          /** Never overwrite existing files         */
+  int counter;           /** Number of the next file                */
+  int supersample;       /** Frames are this many times too large   */
+  int frames;
+  double tstart;
+  int width;             /** Size of the buffers                    */
+  int height;
+  GLuint pbo[RECORDPBOS];
+  int pending[RECORDPBOS];
+  RECORDFRAME inflight[RECORDPBOS];
+  int head;              /** Next pixel buffer in the ring          */
+  pthread_t encoders[RECORDENCODERS];
+  int nencoders;
+  pthread_mutex_t lock;  /** Guards everything below                */
+  pthread_cond_t changed;
+  RECORDFRAME queue[RECORDIMAGES];
+  int queuestart;
+  int queuelength;
+  int nextsequence;      /** Next frame to append to the stream     */
+  BITMAP4 *freeimages[RECORDIMAGES];
+  int nfree;
+  int nimages;
+  int quit;
+} RECORDER;
+
 typedef int* VECINT;
 typedef double* VECDBL;
 typedef double** MATDBL;
 
+/** Scratch space for CoinOperation and TranslationOperation, made once
+    by MallocWorkspace so that the steps allocate nothing */
+typedef struct {
+  int nodes;
+  int maxdegree;
+  VECINT degree;         /** Degree of each vertex                    */
+  VECDBL v;              /** Amplitudes at one vertex, maxdegree long */
+  VECDBL vNew;
+  MATDBL coin;           /** maxdegree x maxdegree                    */
+  MATDBL spaceOld;       /** n x n copy of the space for the shift    */
+} QWWORKSPACE;
+
 #define NOSTEREO     0
 #define ACTIVESTEREO 1
 #define DUALSTEREO   2
@@ -171,6 +444,8 @@ void HandleWindowMenu(int);
 
 /** qw_graphlayout.c */
 void LayoutGraph(GRAPH *);
+void NativeBoundingBox(GRAPH *);
+void NormaliseBoundingBox(GRAPH *);
 void ScaleCoordinates(GRAPH *, double, double);
 void ScaleCoordinatesFromFile(GRAPH *);
 
@@ -181,12 +456,17 @@ void MallocCoordinateLists(GRAPH *);
 void FreeCoordinateLists(GRAPH *);
 void MallocQWprob(QWDATA *, GRAPH *);
 void FreeQWprob(QWDATA *, GRAPH *);
+void MallocNeighbourLists(GRAPH *, int);
+void FreeNeighbourLists(GRAPH *);
 void MallocVecInt(VECINT *, int);
 void FreeVecInt(VECINT *);
 void MallocVecDbl(VECDBL *, int);
 void FreeVecDbl(VECDBL *);
 void MallocMatDbl(MATDBL *, int, int);
 void FreeMatDbl(MATDBL *, int);
+void MallocWorkspace(QWWORKSPACE *, GRAPH *);
+void FreeWorkspace(QWWORKSPACE *);
+long AllocationCount(void);
 
 /** qw_readfiles.c */
 int ReadQWML(QWFILE *, QWDATA *, GRAPH *);
@@ -206,21 +486,161 @@ char ReadFilename(int , char **, QWFILE *);
 void CreateGeometry(int, int, GRAPH *, QWDATA *);
 void ComputeMaxProb(QWDATA *, GRAPH *);
 void ComputeNodeRadius(GRAPH *);
+void NearestNeighbourDistances(GRAPH *, double, double *);
+void NearestNeighbourRows(int, int, void *);
 void ComputeColourMap(void);
+COLOUR *LookupColour(double, double);
 void DrawScale(QWDATA *, COLOUR *);
 void DrawExtras(INTERFACESTATE, QWDATA *);
 void CreateVertexArrow(GRAPH *);
 void LabelVertex(void);
 
+/** qw_offscreen.c */
+int CreateOffscreenContext(void);
+void DestroyOffscreenContext(void);
+int CreateOffscreenBuffer(int, int);
+void DestroyOffscreenBuffer(void);
+void DrawOffscreenFrame(int, int, int, int);
+void DrawOffscreenTile(int, int, int, int, int, int, int, int);
+void RenderOffscreen(void);
+void BenchmarkImageWriter(void);
+int TiledScreenshot(char *, int, int, int, int);
+void RenderPoster(void);
+
+/** qw_record.c */
+int ImageFormat(void);
+char *ImageExtension(int);
+void *EncodeFrames(void *);
+void StreamFrame(RECORDFRAME *);
+void OpenStream(int, int);
+BITMAP4 *GetRecordImage(void);
+void CompleteReadback(int);
+void CompleteAllReadbacks(void);
+void IssueReadback(GLenum, char *, int);
+void ResizeRecording(int, int);
+void StartRecording(GLenum, GLenum, int, int);
+int RecordFrame(int, int, int, int);
+void FinishRecording(void);
+
+/** qw_glstate.c */
+void InvalidateGLState(void);
+void StartGLStateFrame(void);
+void SetGLCapability(GLenum, int);
+
+/** qw_forcelayout.c */
+void MultilevelLayout(GRAPH *);
+int BuildLayoutLevels(GRAPH *, LAYOUTLEVEL *, unsigned int *);
+int CoarsenLevel(LAYOUTLEVEL *, LAYOUTLEVEL *, unsigned int *);
+void ForceDirected(LAYOUTLEVEL *, double, int, double);
+void BuildForceGrid(FORCEPASS *);
+void ComputeForces(int, int, void *);
+void FreeLayoutLevel(LAYOUTLEVEL *);
+double LayoutRandom(unsigned int *);
+double LayoutStress(GRAPH *, double *);
+void BenchmarkLayout(GRAPH *);
+
+/** qw_layoutcache.c */
+void CachedLayoutGraph(GRAPH *);
+unsigned long long GraphHash(GRAPH *);
+unsigned long long HashBytes(unsigned long long, void *, size_t);
+void LayoutCacheName(GRAPH *, char *, int);
+int ReadLayoutCache(GRAPH *);
+void WriteLayoutCache(GRAPH *);
+int MakeCacheDirectory(char *);
+
+/** qw_layoutthread.c */
+void StartBackgroundLayout(GRAPH *);
+void *LayoutWorker(void *);
+void PublishLayoutLevel(LAYOUTLEVEL *, int, double *, double *);
+void AnimateLayout(GRAPH *);
+void FreeBackgroundLayout(void);
+
+/** qw_spectrallayout.c */
+void SpectralLayout(GRAPH *);
+int SpectralRefine(LAYOUTLEVEL *, double *, int, unsigned int *);
+int DOrthonormalise(double *, int, int, int, double *);
+void LaplacianProduct(LAYOUTLEVEL *, double *, double *, int);
+void LaplacianRows(int, int, void *);
+void CombineColumns(double *, int, double *, int, int, int, double *);
+double DotProduct(double *, double *, int);
+double DDotProduct(double *, double *, double *, int);
+void SymmetricEigen(double *, int, double *, double *);
+
+/** qw_sweep.c */
+void SearchSweep(GRAPH *, QWDATA *, QWPARAM *);
+void SweepRows(int, int, void *);
+void StartSweep(GRAPH *, QWDATA *, QWPARAM *, QWFILE *);
+void StartRows(int, int, void *);
+void StartFileName(STARTPASS *, int, char *, int);
+void SearchPeak(GRAPH *, int, int, double *, double *, double *, int *);
+int ParseVertexList(char *, int, int **);
+
+/** qw_quotient.c */
+void QuotientWalk(GRAPH *, QWDATA *, QWPARAM *);
+int EquitablePartition(GRAPH *, int, int *);
+void BuildQuotient(GRAPH *, int, int *, QUOTIENT *);
+int QuotientArc(QUOTIENT *, int, int);
+void FreeQuotient(QUOTIENT *);
+int CompareInts(const void *, const void *);
+
+/** qw_reorder.c */
+void ReorderGraph(GRAPH *, QWPARAM *);
+void RestoreGraphOrder(GRAPH *, QWDATA *, QWPARAM *);
+void PermuteAdjacency(GRAPH *, int *);
+void ReverseCuthillMcKee(GRAPH *, int *);
+int CuthillMcKeeLevels(GRAPH *, int, int *, int, int *, int *, int *);
+int VertexDegree(GRAPH *, int);
+int GraphBandwidth(GRAPH *);
+void BenchmarkReorder(GRAPH *);
+long StepCacheMisses(GRAPH *, int);
+long FusedCacheMisses(GRAPH *);
+void CacheTouch(CACHEMODEL *, unsigned long);
+
+/** qw_checkpoint.c */
+int CheckpointDue(QWDATA *, QWPARAM *, int);
+int ReadCheckpoint(GRAPH *, QWDATA *, QWPARAM *, double *);
+void WriteCheckpoint(GRAPH *, QWDATA *, QWPARAM *, double *, int);
+int WalkCacheOn(void);
+void WalkCacheName(GRAPH *, QWDATA *, QWPARAM *, char *, int);
+int ReadWalkFile(char *, GRAPH *, QWDATA *, QWPARAM *, double *, int);
+void WriteWalkFile(char *, GRAPH *, QWDATA *, QWPARAM *, double *, int);
+void TrimWalkCache(char *, double, char *);
+void SpaceToArcs(MATDBL, GRAPH *, double *);
+void ArcsToSpace(double *, GRAPH *, MATDBL *);
+double *MallocCheckpointState(GRAPH *, QWPARAM *);
+
+/** qw_batch.c */
+void MallocWalkBatch(WALKBATCH *, GRAPH *);
+void FreeWalkBatch(WALKBATCH *);
+void BatchEqualSuperposition(WALKBATCH *);
+void BatchSingleVertex(WALKBATCH *, int *);
+void BatchStep(WALKBATCH *);
+void BatchProbabilities(WALKBATCH *, double *);
+double BatchVertexProbability(WALKBATCH *, int, int);
+void BenchmarkWalk(GRAPH *, QWDATA *, QWPARAM *);
+
+/** qw_fused.c */
+double *MallocArcAmplitudes(GRAPH *);
+void ArcEqualSuperposition(GRAPH *, double *);
+void ArcSingleVertex(GRAPH *, int, double *);
+double FusedStep(GRAPH *, int, double *, double *, double **, int);
+void SplitStep(GRAPH *, int, double *, double *, double *);
+void BenchmarkFused(GRAPH *, QWPARAM *);
+
 /** qw_compute.c */
 void DegreeVec(VECINT *, GRAPH *);
+void BuildNeighbourLists(GRAPH *);
 double Normalisation(MATDBL, int );
+void InitialiseNormDrift(NORMDRIFT *);
+int CheckNorm(NORMDRIFT *, double, int);
+void ScaleAmplitudes(double *, int, double);
+void ReportNormDrift(NORMDRIFT *, char *);
 void InitialiseSingleVertex(MATDBL *, GRAPH *, QWPARAM * );
 void InitialiseEqualSuperposition(MATDBL *, GRAPH *);
 void Grover(MATDBL *, int );
 void NegativeIdentity(MATDBL *, int );
-void CoinOperation(MATDBL *, GRAPH *, QWPARAM *);
-void TranslationOperation(MATDBL *, GRAPH *);
+void CoinOperation(MATDBL *, GRAPH *, QWPARAM *, QWWORKSPACE *);
+void TranslationOperation(MATDBL *, GRAPH *, QWWORKSPACE *);
 void QuantumSearch(GRAPH *, QWDATA *, QWPARAM *);
 void QuantumWalk(GRAPH *, QWDATA *, QWPARAM *);
 char* Trim(char *);
@@ -64,15 +64,54 @@ int Same_BitmapPixel(BITMAP4 p1,BITMAP4 p2)
 	  7 == EPS black and white
  	  8 == raw
      9 == BMP
+    14 == png
+    15 == png with alpha
 	A negative format indicates a vertical flip
 */
 void Write_Bitmap(FILE *fptr,BITMAP4 *bm,int nx,int ny,int format)
 {
-   int i,j,offset;
-	long index,rowindex;
-	int linelength = 0,size;
+	BITMAPSTREAM stream;
+
+	if (Open_BitmapStream(&stream,fptr,nx,ny,format) != 0)
+		return;
+	Write_BitmapStream(&stream,bm,ny);
+	Close_BitmapStream(&stream);
+}
+
+/*
+	Start writing a bitmap a few rows at a time, see Write_Bitmap for 
+	the formats. The header is written here, the rows are passed in 
+	file order to Write_BitmapStream and Close_BitmapStream finishes the
+	file. Returns 0 on success.
+*/
+int Open_BitmapStream(BITMAPSTREAM *stream,FILE *fptr,int nx,int ny,int format)
+{
+	int offset,size;
 	char buffer[1024];
 
+	stream->fptr = fptr;
+	stream->nx = nx;
+	stream->ny = ny;
+	stream->format = format;
+	stream->linelength = 0;
+	stream->previous = NULL;
+	stream->zbuffer = NULL;
+
+	/* Binary rows are assembled here and written with one fwrite */
+	if ((stream->row = malloc(4*nx)) == NULL) {
+		fprintf(stderr,"Open_BitmapStream - Failed to allocate row buffer\n");
+		return(1);
+	}
+	if (ABS(format) == 14 || ABS(format) == 15) {
+		if (PNG_OpenStream(stream) != 0) {
+			free(stream->row);
+			free(stream->previous);
+			free(stream->zbuffer);
+			return(1);
+		}
+		return(0);
+	}
+
 	/* Write the header */
 	switch (ABS(format)) {
 	case 1:
@@ -202,66 +241,100 @@ void Write_Bitmap(FILE *fptr,BITMAP4 *bm,int nx,int ny,int format)
       putc(0,fptr); putc(0,fptr); putc(0,fptr); putc(0,fptr); 
 		break;
 	}
+	return(0);
+}
+
+/*
+	Write the next nrows rows of a bitmap stream. The rows are in file
+	order, except that for a negative format the block is flipped.
+*/
+void Write_BitmapStream(BITMAPSTREAM *stream,BITMAP4 *bm,int nrows)
+{
+	FILE *fptr = stream->fptr;
+	int i,j,nx = stream->nx,format = stream->format;
+	long index,rowindex;
+	int rowlength;
+	unsigned char *row = stream->row;
 
-	/* Write the binary data */
-   for (j=0;j<ny;j++) {
+	switch (ABS(format)) {
+	case 12:
+		WriteTGACompressedRows(fptr,bm,nx,nrows,3,format < 0);
+		return;
+	case 13:
+		WriteTGACompressedRows(fptr,bm,nx,nrows,4,format < 0);
+		return;
+	case 14:
+	case 15:
+		PNG_WriteStream(stream,bm,nrows);
+		return;
+	}
+   for (j=0;j<nrows;j++) {
 		if (format > 0)
 			rowindex = j * nx;
 		else
-			rowindex = (ny - 1 - j) * nx;
-		switch (ABS(format)) {
-	   case 12:
-         WriteTGACompressedRow(fptr,&(bm[rowindex]),nx,3);
-         break;
-      case 13:
-         WriteTGACompressedRow(fptr,&(bm[rowindex]),nx,4);
-         break;
-		}	
+			rowindex = (nrows - 1 - j) * nx;
+		rowlength = 0;
       for (i=0;i<nx;i++) {
-			if (format > 0) 
-         	index = rowindex + i;
-			else
-				index = rowindex + i;
+			index = rowindex + i;
 			switch (ABS(format)) {
 			case 1:
 			case 11:
 			case 9:
-            putc(bm[index].b,fptr);
-            putc(bm[index].g,fptr);
-            putc(bm[index].r,fptr);
+            row[rowlength++] = bm[index].b;
+            row[rowlength++] = bm[index].g;
+            row[rowlength++] = bm[index].r;
 				if (ABS(format) == 11)
-					putc(bm[index].a,fptr);
+					row[rowlength++] = bm[index].a;
             break;
 			case 2:
 			case 3:
 			case 5:
 			case 8:
-            putc(bm[index].r,fptr);
-            putc(bm[index].g,fptr);
-            putc(bm[index].b,fptr);
+            row[rowlength++] = bm[index].r;
+            row[rowlength++] = bm[index].g;
+            row[rowlength++] = bm[index].b;
 				break;
 			case 4:
-				putc((bm[index].r+bm[index].g+bm[index].b)/3,fptr);
+				row[rowlength++] = (bm[index].r+bm[index].g+bm[index].b)/3;
 				break;
 			case 6:
 				fprintf(fptr,"%02x%02x%02x",bm[index].r,bm[index].g,bm[index].b);
-				linelength += 6;
-				if (linelength >= 72 || linelength >= nx) {
+				stream->linelength += 6;
+				if (stream->linelength >= 72 || stream->linelength >= nx) {
 					fprintf(fptr,"\n");
-					linelength = 0;
+					stream->linelength = 0;
 				}	
 				break;
          case 7:
             fprintf(fptr,"%02x",(bm[index].r+bm[index].g+bm[index].b)/3);
-            linelength += 2;
-            if (linelength >= 72 || linelength >= nx) {
+            stream->linelength += 2;
+            if (stream->linelength >= 72 || stream->linelength >= nx) {
                fprintf(fptr,"\n");
-               linelength = 0;
+               stream->linelength = 0;
             } 
             break;
 			}
       }
+		if (rowlength > 0)
+			fwrite(row,1,rowlength,fptr);
    }
+}
+
+/*
+	Write the footer of a bitmap stream and free its buffers
+*/
+void Close_BitmapStream(BITMAPSTREAM *stream)
+{
+	FILE *fptr = stream->fptr;
+	int nx = stream->nx,ny = stream->ny,format = stream->format;
+	int offset;
+	char buffer[1024];
+
+	free(stream->row);
+	if (ABS(format) == 14 || ABS(format) == 15) {
+		PNG_CloseStream(stream);
+		return;
+	}
 
 	/* Write the footer */
 	switch (ABS(format)) {
@@ -367,13 +440,259 @@ void Write_Bitmap(FILE *fptr,BITMAP4 *bm,int nx,int ny,int format)
 	}
 }
 
+/*
+	Start a PNG stream, 8 bits per channel, RGB (format 14) or RGBA 
+	(format 15). The rows are deflated as one zlib stream that is 
+	written out in IDAT chunks of PNGCHUNKSIZE as it fills.
+*/
+int PNG_OpenStream(BITMAPSTREAM *stream)
+{
+	unsigned char header[13];
+
+	stream->depth = (ABS(stream->format) == 15) ? 4 : 3;
+	stream->previous = malloc((long)stream->nx * stream->depth);
+	stream->zbuffer = malloc(PNGCHUNKSIZE);
+	if (stream->previous == NULL || stream->zbuffer == NULL) {
+		fprintf(stderr,"PNG_OpenStream - Failed to allocate buffers\n");
+		return(1);
+	}
+	memset(&(stream->z),0,sizeof(z_stream));
+	if (deflateInit(&(stream->z),Z_DEFAULT_COMPRESSION) != Z_OK) {
+		fprintf(stderr,"PNG_OpenStream - Failed to start compression\n");
+		return(1);
+	}
+	stream->z.next_out = stream->zbuffer;
+	stream->z.avail_out = PNGCHUNKSIZE;
+	stream->firstrow = TRUE;
+
+	BM_WriteHexString(stream->fptr,"89504e470d0a1a0a");	/* PNG signature */
+	PNG_PutLong(&header[0],stream->nx);
+	PNG_PutLong(&header[4],stream->ny);
+	header[8] = 8;                                 /* Bits per channel     */
+	header[9] = (stream->depth == 4) ? 6 : 2;      /* RGBA or RGB          */
+	header[10] = 0;                                /* Deflate              */
+	header[11] = 0;                                /* Adaptive filtering   */
+	header[12] = 0;                                /* Not interlaced       */
+	PNG_WriteChunk(stream->fptr,"IHDR",header,13);
+	return(0);
+}
+
+/*
+	Add rows to a PNG stream. Rows are filtered in parallel, each with
+	whichever of the five PNG filters gives the smallest sum of absolute
+	values, then deflated. The last row is kept for filtering the next.
+*/
+void PNG_WriteStream(BITMAPSTREAM *stream,BITMAP4 *bm,int nrows)
+{
+	PNGROWS rows;
+	BITMAP4 *last;
+	int i;
+
+	rows.bm = bm;
+	rows.nx = stream->nx;
+	rows.ny = nrows;
+	rows.depth = stream->depth;
+	rows.flip = (stream->format < 0);
+	rows.previous = stream->firstrow ? NULL : stream->previous;
+	rows.rowsize = 1 + (long)rows.nx * rows.depth;
+	if ((rows.buffer = malloc(nrows * rows.rowsize)) == NULL) {
+		fprintf(stderr,"PNG_WriteStream - Failed to allocate row buffer\n");
+		return;
+	}
+	ParallelFor(nrows,FilterPNGRows,&rows);
+	PNG_Deflate(stream,rows.buffer,nrows * rows.rowsize,Z_NO_FLUSH);
+	free(rows.buffer);
+
+	last = &(bm[(long)(rows.flip ? 0 : nrows-1) * rows.nx]);
+	for (i=0;i<rows.nx;i++) {
+		stream->previous[i*rows.depth]   = last[i].r;
+		stream->previous[i*rows.depth+1] = last[i].g;
+		stream->previous[i*rows.depth+2] = last[i].b;
+		if (rows.depth == 4)
+			stream->previous[i*rows.depth+3] = last[i].a;
+	}
+	stream->firstrow = FALSE;
+}
+
+/*
+	Deflate data into the stream, writing an IDAT chunk each time the
+	output buffer fills, and whatever is left when flush is Z_FINISH
+*/
+void PNG_Deflate(BITMAPSTREAM *stream,unsigned char *data,long length,int flush)
+{
+	int status;
+
+	stream->z.next_in = data;
+	stream->z.avail_in = length;
+	do {
+		status = deflate(&(stream->z),flush);
+		if (stream->z.avail_out == 0 || (flush == Z_FINISH && status == Z_STREAM_END)) {
+			PNG_WriteChunk(stream->fptr,"IDAT",stream->zbuffer,
+				PNGCHUNKSIZE - stream->z.avail_out);
+			stream->z.next_out = stream->zbuffer;
+			stream->z.avail_out = PNGCHUNKSIZE;
+		}
+	} while (stream->z.avail_in > 0 || (flush == Z_FINISH && status == Z_OK));
+}
+
+/*
+	Finish the zlib stream and end the PNG
+*/
+void PNG_CloseStream(BITMAPSTREAM *stream)
+{
+	if (stream->zbuffer != NULL) {
+		PNG_Deflate(stream,NULL,0,Z_FINISH);
+		deflateEnd(&(stream->z));
+		PNG_WriteChunk(stream->fptr,"IEND",NULL,0);
+	}
+	free(stream->previous);
+	free(stream->zbuffer);
+}
+
+/*
+	Filter a block of PNG rows, called from ParallelFor.
+	Each row goes to its own place in the shared buffer, a filter type
+	byte followed by the filtered bytes.
+*/
+void FilterPNGRows(int start,int end,void *arg)
+{
+	PNGROWS *rows = arg;
+	unsigned char *raw,*above,*candidate[5],*out;
+	int i,j,k,f,best,a,b,c,p,pa,pb,pc,n;
+	long sum,bestsum;
+	long rowindex;
+
+	n = rows->nx * rows->depth;
+	if ((raw = malloc(7*n)) == NULL) {
+		fprintf(stderr,"FilterPNGRows - Failed to allocate row buffers\n");
+		return;
+	}
+	above = raw + n;
+	for (f=0;f<5;f++)
+		candidate[f] = raw + (2+f)*n;
+
+	for (j=start;j<end;j++) {
+
+		/* Unpack this row and the one above it. Above the first row of
+			the block is the last row written, or zero at the top */
+		for (k=0;k<2;k++) {
+			out = (k == 0) ? raw : above;
+			if (j-k < 0) {
+				if (rows->previous != NULL)
+					memcpy(out,rows->previous,n);
+				else
+					memset(out,0,n);
+				continue;
+			}
+			if (rows->flip)
+				rowindex = (long)(rows->ny - 1 - (j-k)) * rows->nx;
+			else
+				rowindex = (long)(j-k) * rows->nx;
+			for (i=0;i<rows->nx;i++) {
+				*out++ = rows->bm[rowindex+i].r;
+				*out++ = rows->bm[rowindex+i].g;
+				*out++ = rows->bm[rowindex+i].b;
+				if (rows->depth == 4)
+					*out++ = rows->bm[rowindex+i].a;
+			}
+		}
+
+		/* None, Sub, Up, Average, Paeth */
+		for (i=0;i<n;i++) {
+			a = (i >= rows->depth) ? raw[i-rows->depth] : 0;
+			b = above[i];
+			c = (i >= rows->depth) ? above[i-rows->depth] : 0;
+			p = a + b - c;
+			pa = ABS(p - a);
+			pb = ABS(p - b);
+			pc = ABS(p - c);
+			if (pa <= pb && pa <= pc)
+				p = a;
+			else if (pb <= pc)
+				p = b;
+			else
+				p = c;
+			candidate[0][i] = raw[i];
+			candidate[1][i] = raw[i] - a;
+			candidate[2][i] = raw[i] - b;
+			candidate[3][i] = raw[i] - (a + b) / 2;
+			candidate[4][i] = raw[i] - p;
+		}
+		best = 0;
+		bestsum = -1;
+		for (f=0;f<5;f++) {
+			sum = 0;
+			for (i=0;i<n;i++)
+				sum += (candidate[f][i] < 128) ? candidate[f][i] : 256 - candidate[f][i];
+			if (bestsum < 0 || sum < bestsum) {
+				best = f;
+				bestsum = sum;
+			}
+		}
+		out = &(rows->buffer[j*rows->rowsize]);
+		out[0] = best;
+		memcpy(&out[1],candidate[best],n);
+	}
+	free(raw);
+}
+
+/*
+	Write one PNG chunk: length, type, data and the CRC of type and data
+*/
+void PNG_WriteChunk(FILE *fptr,char *type,unsigned char *data,long length)
+{
+	unsigned char word[4];
+	uLong crc;
+
+	PNG_PutLong(word,length);
+	fwrite(word,1,4,fptr);
+	fwrite(type,1,4,fptr);
+	crc = crc32(0L,(unsigned char *)type,4);
+	if (length > 0) {
+		fwrite(data,1,length,fptr);
+		crc = crc32(crc,data,length);
+	}
+	PNG_PutLong(word,crc);
+	fwrite(word,1,4,fptr);
+}
+
+/*
+	Store a 32 bit big endian integer
+*/
+void PNG_PutLong(unsigned char *p,unsigned long n)
+{
+	p[0] = (n >> 24) & 0xff;
+	p[1] = (n >> 16) & 0xff;
+	p[2] = (n >> 8) & 0xff;
+	p[3] = n & 0xff;
+}
+
 /*
 	Write a compressed TGA row
 	Depth is either 3 or 4
 */
 void WriteTGACompressedRow(FILE *fptr,BITMAP4 *bm,int width,int depth)
 {
-	int i;
+	unsigned char *buffer;
+	int length;
+
+	if ((buffer = malloc(TGAROWSIZE(width,depth))) == NULL) {
+		fprintf(stderr,"WriteTGACompressedRow - Failed to allocate row buffer\n");
+		return;
+	}
+	length = EncodeTGACompressedRow(buffer,bm,width,depth);
+	fwrite(buffer,1,length,fptr);
+	free(buffer);
+}
+
+/*
+	Run length encode a TGA row into buffer, which must hold 
+	TGAROWSIZE(width,depth) bytes. Returns the number of bytes used.
+	Depth is either 3 or 4
+*/
+int EncodeTGACompressedRow(unsigned char *buffer,BITMAP4 *bm,int width,int depth)
+{
+	int i,n = 0;
 	int counter = 1;
 	int pixelstart = 0;
 	int packettype = 0;
@@ -414,21 +733,21 @@ void WriteTGACompressedRow(FILE *fptr,BITMAP4 *bm,int width,int depth)
 			if (pixelstart + counter > width)
 				counter = width - pixelstart;
 			if (packettype == 0) {
-				putc(((counter-1) | 0x80),fptr);
-            putc(currentpixel.b,fptr);
-            putc(currentpixel.g,fptr);
-            putc(currentpixel.r,fptr);
+				buffer[n++] = ((counter-1) | 0x80);
+            buffer[n++] = currentpixel.b;
+            buffer[n++] = currentpixel.g;
+            buffer[n++] = currentpixel.r;
             if (depth == 4)
-               putc(currentpixel.a,fptr);
+               buffer[n++] = currentpixel.a;
 				currentpixel = nextpixel;
 			} else {
-				putc(counter-1,fptr);
+				buffer[n++] = counter-1;
 				for (i=0;i<counter;i++) {
-					putc(bm[pixelstart+i].b,fptr);
-            	putc(bm[pixelstart+i].g,fptr);
-            	putc(bm[pixelstart+i].r,fptr);
+					buffer[n++] = bm[pixelstart+i].b;
+            	buffer[n++] = bm[pixelstart+i].g;
+            	buffer[n++] = bm[pixelstart+i].r;
             	if (depth == 4)
-               	putc(bm[pixelstart+i].a,fptr);
+               	buffer[n++] = bm[pixelstart+i].a;
 				}
 			}
 			if ((pixelstart = pixelstart + counter) >= width)
@@ -438,6 +757,63 @@ void WriteTGACompressedRow(FILE *fptr,BITMAP4 *bm,int width,int depth)
 			counter = 1;
 		}
 	}
+	return(n);
+}
+
+/*
+	Encode a block of rows of a compressed TGA, called from ParallelFor.
+	Each row is encoded at its own fixed offset in the shared buffer.
+*/
+void EncodeTGACompressedRows(int start,int end,void *arg)
+{
+	TGAROWS *rows = arg;
+	int j;
+	long rowindex;
+
+	for (j=start;j<end;j++) {
+		if (rows->flip)
+			rowindex = (long)(rows->ny - 1 - j) * rows->nx;
+		else
+			rowindex = (long)j * rows->nx;
+		rows->length[j] = EncodeTGACompressedRow(&(rows->buffer[j*rows->rowsize]),
+			&(rows->bm[rowindex]),rows->nx,rows->depth);
+	}
+}
+
+/*
+	Write the body of a compressed TGA. The rows are encoded in 
+	parallel, packed together and written with a single fwrite.
+*/
+void WriteTGACompressedRows(FILE *fptr,BITMAP4 *bm,int nx,int ny,int depth,int flip)
+{
+	TGAROWS rows;
+	int j;
+	long total = 0;
+
+	rows.bm = bm;
+	rows.nx = nx;
+	rows.ny = ny;
+	rows.depth = depth;
+	rows.flip = flip;
+	rows.rowsize = TGAROWSIZE(nx,depth);
+	rows.buffer = malloc(ny * rows.rowsize);
+	rows.length = malloc(ny * sizeof(int));
+	if (rows.buffer == NULL || rows.length == NULL) {
+		fprintf(stderr,"WriteTGACompressedRows - Failed to allocate row buffers\n");
+		free(rows.buffer);
+		free(rows.length);
+		return;
+	}
+
+	ParallelFor(ny,EncodeTGACompressedRows,&rows);
+	for (j=0;j<ny;j++) {
+		memmove(&(rows.buffer[total]),&(rows.buffer[j*rows.rowsize]),rows.length[j]);
+		total += rows.length[j];
+	}
+	fwrite(rows.buffer,1,total,fptr);
+
+	free(rows.buffer);
+	free(rows.length);
 }
 
 void BM_WriteLongInt(FILE *fptr,char *s,long n)
@@ -486,54 +862,43 @@ void Erase_Bitmap(BITMAP4 *bm, int nx, int ny, BITMAP4 col)
 
 /*
 	Scale an image using bicubic interpolation
+	The 4x4 kernel is separable, so the image is scaled across and then
+	down, each pass using a table of the 4 weights of every output pixel.
 */
 void BiCubicScale(
    BITMAP4 *bm_in,int nx,int ny,
    BITMAP4 *bm_out,int nnx,int nny)
 {
-   int i_out,j_out,i_in,j_in,ii,jj;
-   int n,m;
-	long index;
-   double cx,cy,dx,dy,weight;
-   double red,green,blue,alpha;
-   BITMAP4 col;
- 
-   for (i_out=0;i_out<nnx;i_out++) {
-      for (j_out=0;j_out<nny;j_out++) {
-         i_in = (i_out * nx) / nnx;
-         j_in = (j_out * ny) / nny;
-         cx = i_out * nx / (double)nnx;
-         cy = j_out * ny / (double)nny;
-         dx = cx - i_in;
-         dy = cy - j_in;
-         red   = 0;
-         green = 0;
-         blue  = 0;
-			alpha = 0;
-         for (m=-1;m<=2;m++) {
-            for (n=-1;n<=2;n++) {
-               ii = i_in + m;
-               jj = j_in + n;
-               if (ii < 0)   ii = 0;
-               if (ii >= nx) ii = nx-1;
-               if (jj < 0)   jj = 0;
-               if (jj >= ny) jj = ny-1;
-               index = jj * nx + ii;
-               weight = BiCubicR(m-dx) * BiCubicR(n-dy);
-	       /* weight = BiCubicR(m-dx) * BiCubicR(dy-n); */
-               red   += weight * bm_in[index].r;
-               green += weight * bm_in[index].g;
-               blue  += weight * bm_in[index].b;
-					alpha += weight * bm_in[index].a;
-            }
-         }
-         col.r = (int)red;
-         col.g = (int)green;
-         col.b = (int)blue;
-			col.a = (int)alpha;
-         bm_out[j_out * nnx + i_out] = col;
-      }
-   }
+	SCALETABLE *across,*down;
+
+	across = BiCubicTable(nx,nnx);
+	down = BiCubicTable(ny,nny);
+	if (across != NULL && down != NULL)
+		SeparableScale(bm_in,nx,ny,bm_out,nnx,nny,across,down);
+	Destroy_ScaleTable(across);
+	Destroy_ScaleTable(down);
+}
+
+/*
+	Weight table for bicubic scaling of nin samples to nout
+*/
+SCALETABLE *BiCubicTable(int nin,int nout)
+{
+	SCALETABLE *table;
+	int i,m,i_in;
+	double dx;
+
+	if ((table = Create_ScaleTable(nout,4)) == NULL)
+		return(NULL);
+	for (i=0;i<nout;i++) {
+		i_in = (i * nin) / nout;
+		dx = i * nin / (double)nout - i_in;
+		for (m=-1;m<=2;m++) {
+			table->index[i*4+m+1] = SCALECLAMP(i_in+m,nin);
+			table->weight[i*4+m+1] = BiCubicR(m-dx);
+		}
+	}
+	return(table);
 }
 
 double BiCubicR(double x)
@@ -561,64 +926,178 @@ double BiCubicR(double x)
 	Scale a bitmap
 	Apply a gaussian radial average if r > 0
 	r is in units of the input image
+	The gaussian is separable, so the image is scaled across and then
+	down, each pass using a table of the weights of every output pixel.
 */
 void GaussianScale(
 	BITMAP4 *bm_in,int nx,int ny,
 	BITMAP4 *bm_out,int nnx,int nny,double r)
 {
-	int i,j,ii,jj,ci,cj;
-	long index;
-	double x,y,cx,cy,red,green,blue,alpha,dist2,r2,weight,sum;
-	BITMAP4 col,black = {0,0,0,255};
+	SCALETABLE *across,*down;
+
+	across = GaussianTable(nx,nnx,r);
+	down = GaussianTable(ny,nny,r);
+	if (across != NULL && down != NULL)
+		SeparableScale(bm_in,nx,ny,bm_out,nnx,nny,across,down);
+	Destroy_ScaleTable(across);
+	Destroy_ScaleTable(down);
+}
+
+/*
+	Weight table for gaussian scaling of nin samples to nout, sampling
+	every input pixel within 4r. With r <= 0 it picks the nearest pixel.
+	The 1/(2 pi r^2) normalisation is split between the two passes.
+*/
+SCALETABLE *GaussianTable(int nin,int nout,double r)
+{
+	SCALETABLE *table;
+	int i,k,ntaps;
+	double c,x,r2;
 
 	r2 = r*r;
+	ntaps = (r2 <= 0) ? 1 : (int)floor(8*r+0.01) + 1;
+	if ((table = Create_ScaleTable(nout,ntaps)) == NULL)
+		return(NULL);
+	for (i=0;i<nout;i++) {
+		if (r2 <= 0) {
+			table->index[i] = (i * nin) / nout;
+			table->weight[i] = 1;
+			continue;
+		}
+		c = i * nin / (double)nout;
+		for (k=0;k<ntaps;k++) {
+			x = c - 4*r + k;
+			table->index[i*ntaps+k] = SCALECLAMP((int)x,nin);
+			table->weight[i*ntaps+k] = exp(-0.5*(c-x)*(c-x)/r2) / sqrt(r2*TWOPI);
+		}
+	}
+	return(table);
+}
 
-	for (i=0;i<nnx;i++) {
-		for (j=0;j<nny;j++) {
-			col = black;
-			if (r2 <= 0) {
-         	ci = (i * nx) / nnx;
-         	cj = (j * ny) / nny;
-				index = cj * nx + ci;
-				col = bm_in[index];
-			} else {
-            cx = i * nx / (double)nnx;
-            cy = j * ny / (double)nny;
-				red   = 0;
-				green = 0;
-				blue  = 0;
-				alpha = 0;
-				sum = 0;
-				for (x=cx-4*r;x<=cx+4*r+0.01;x++) {
-					for (y=cy-4*r;y<=cy+4*r+0.01;y++) {
-						ii = (int)x;
-						jj = (int)y;
-						if (ii < 0)
-							ii = 0;
-						if (ii >= nx)
-							ii = nx-1;;
-						if (jj < 0)
-							jj = 0;
-						if (jj >= ny) 
-							jj = ny-1;
-						dist2 = (cx-x)*(cx-x) + (cy-y)*(cy-y);
-						weight = exp(-0.5*dist2/r2) / (r2*TWOPI);
-						index = jj * nx + ii;
-						red   += weight * bm_in[index].r;
-						green += weight * bm_in[index].g;
-						blue  += weight * bm_in[index].b;
-						alpha += weight * bm_in[index].a;
-						sum += weight;
-					}
-				}
-				col.r = (int)red;
-            col.g = (int)green;
-            col.b = (int)blue;
-				col.a = (int)alpha;
+/*
+	Create and destroy the weights for n output samples with ntaps 
+	input samples each
+*/
+SCALETABLE *Create_ScaleTable(int n,int ntaps)
+{
+	SCALETABLE *table;
+
+	if ((table = malloc(sizeof(SCALETABLE))) == NULL)
+		return(NULL);
+	table->n = n;
+	table->ntaps = ntaps;
+	table->index = malloc((long)n*ntaps*sizeof(int));
+	table->weight = malloc((long)n*ntaps*sizeof(float));
+	if (table->index == NULL || table->weight == NULL) {
+		Destroy_ScaleTable(table);
+		return(NULL);
+	}
+	return(table);
+}
+
+void Destroy_ScaleTable(SCALETABLE *table)
+{
+	if (table == NULL)
+		return;
+	free(table->index);
+	free(table->weight);
+	free(table);
+}
+
+/*
+	Scale a bitmap in two passes with separable weight tables, first 
+	across every input row into a float image nnx by ny, then down 
+	every column of that. Both passes are row parallel.
+*/
+void SeparableScale(
+	BITMAP4 *bm_in,int nx,int ny,
+	BITMAP4 *bm_out,int nnx,int nny,
+	SCALETABLE *across,SCALETABLE *down)
+{
+	SCALEPASS pass;
+
+	pass.bm_in = bm_in;
+	pass.nx = nx;
+	pass.ny = ny;
+	pass.bm_out = bm_out;
+	pass.nnx = nnx;
+	pass.nny = nny;
+	pass.across = across;
+	pass.down = down;
+	if ((pass.work = malloc((long)ny*nnx*4*sizeof(float))) == NULL) {
+		fprintf(stderr,"SeparableScale - Failed to allocate memory\n");
+		return;
+	}
+	ParallelFor(ny,ScaleAcross,&pass);
+	ParallelFor(nny,ScaleDown,&pass);
+	free(pass.work);
+}
+
+/*
+	First pass of SeparableScale, rows start to end of the input
+*/
+void ScaleAcross(int start,int end,void *arg)
+{
+	SCALEPASS *pass = arg;
+	SCALETABLE *t = pass->across;
+	BITMAP4 *in,p;
+	float *out,w;
+	int i,j,k;
+
+	for (j=start;j<end;j++) {
+		in = &(pass->bm_in[(long)j*pass->nx]);
+		out = &(pass->work[(long)j*pass->nnx*4]);
+		for (i=0;i<pass->nnx;i++) {
+			out[0] = out[1] = out[2] = out[3] = 0;
+			for (k=0;k<t->ntaps;k++) {
+				p = in[t->index[i*t->ntaps+k]];
+				w = t->weight[i*t->ntaps+k];
+				out[0] += w * p.r;
+				out[1] += w * p.g;
+				out[2] += w * p.b;
+				out[3] += w * p.a;
 			}
-			bm_out[j * nnx + i] = col;
+			out += 4;
+		}
+	}
+}
+
+/*
+	Second pass of SeparableScale, rows start to end of the output.
+	Whole rows of the first pass are accumulated at a time, a simple 
+	contiguous loop that the compiler vectorises.
+*/
+void ScaleDown(int start,int end,void *arg)
+{
+	SCALEPASS *pass = arg;
+	SCALETABLE *t = pass->down;
+	float *sum,*row,w;
+	int i,j,k,n,v;
+	BITMAP4 *out;
+
+	n = pass->nnx * 4;
+	if ((sum = malloc(n*sizeof(float))) == NULL) {
+		fprintf(stderr,"ScaleDown - Failed to allocate memory\n");
+		return;
+	}
+	for (j=start;j<end;j++) {
+		for (i=0;i<n;i++)
+			sum[i] = 0;
+		for (k=0;k<t->ntaps;k++) {
+			row = &(pass->work[(long)t->index[j*t->ntaps+k]*n]);
+			w = t->weight[j*t->ntaps+k];
+			for (i=0;i<n;i++)
+				sum[i] += w * row[i];
+		}
+		out = &(pass->bm_out[(long)j*pass->nnx]);
+		for (i=0;i<pass->nnx;i++) {
+			v = (int)sum[4*i];   out[i].r = (v < 0) ? 0 : (v > 255 ? 255 : v);
+			v = (int)sum[4*i+1]; out[i].g = (v < 0) ? 0 : (v > 255 ? 255 : v);
+			v = (int)sum[4*i+2]; out[i].b = (v < 0) ? 0 : (v > 255 ? 255 : v);
+			v = (int)sum[4*i+3]; out[i].a = (v < 0) ? 0 : (v > 255 ? 255 : v);
 		}
 	}
+	free(sum);
 }
 
 /*
@@ -1002,6 +1481,64 @@ void TGA_MergeBytes(BITMAP4 *pixel,unsigned char *p,int bytes)
 	}
 }
 
+/*
+	Convert a bitmap to planar YUV 4:2:0 (full range BT.601, as for 
+	JPEG), the Y plane followed by the U and V planes at half size.
+	yuv must hold nx*ny + 2*((nx+1)/2)*((ny+1)/2) bytes.
+	The chroma is the average of each 2x2 block.
+	The rows are converted in parallel, two at a time.
+*/
+void Bitmap_to_YUV420(BITMAP4 *bm,int nx,int ny,unsigned char *yuv,int flip)
+{
+	YUVROWS rows;
+
+	rows.bm = bm;
+	rows.nx = nx;
+	rows.ny = ny;
+	rows.flip = flip;
+	rows.yuv = yuv;
+	ParallelFor((ny+1)/2,YUV420Rows,&rows);
+}
+
+/*
+	Convert a block of row pairs to YUV 4:2:0, called from ParallelFor
+*/
+void YUV420Rows(int start,int end,void *arg)
+{
+	YUVROWS *rows = arg;
+	int i,j,k,di,dj,n,r,g,b,nx = rows->nx,ny = rows->ny,cx = (nx+1)/2;
+	unsigned char *uplane,*vplane;
+	BITMAP4 p;
+
+	uplane = rows->yuv + (long)nx * ny;
+	vplane = uplane + (long)cx * ((ny+1)/2);
+	for (j=start;j<end;j++) {
+		for (i=0;i<cx;i++) {
+			r = g = b = n = 0;
+			for (dj=0;dj<2 && 2*j+dj<ny;dj++) {
+				k = 2*j + dj;
+				for (di=0;di<2 && 2*i+di<nx;di++) {
+					if (rows->flip)
+						p = rows->bm[(long)(ny-1-k)*nx + 2*i+di];
+					else
+						p = rows->bm[(long)k*nx + 2*i+di];
+					rows->yuv[(long)k*nx + 2*i+di] = 
+						(19595*p.r + 38470*p.g + 7471*p.b + 32768) >> 16;
+					r += p.r;
+					g += p.g;
+					b += p.b;
+					n++;
+				}
+			}
+			r /= n;
+			g /= n;
+			b /= n;
+			uplane[(long)j*cx + i] = (-11059*r - 21709*g + 32768*b + 8421376) >> 16;
+			vplane[(long)j*cx + i] = (32768*r - 27439*g - 5329*b + 8421376) >> 16;
+		}
+	}
+}
+
 BITMAP4 YUV_to_Bitmap(int y,int u,int v)
 {  
    int r,g,b; 
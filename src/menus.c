@@ -136,6 +136,7 @@ void HandleMainMenu(int whichone)
 {
   switch (whichone) {
   case 10:
+    FinishRecording();
     exit(0);
     break;
   }
@@ -475,6 +475,141 @@ double VectorLength(XYZ p1,XYZ p2)
 }
 
 
+/*
+ Worker threads used by ParallelFor. Threads started by ParallelFor, 
+ or marked with MarkParallelWorker, run any nested ParallelFor serially.
+ */
+static int parallelthreads = 1;
+static __thread int parallelworker = FALSE;
+
+void SetParallelThreads(int n)
+{
+	if (n < 1)
+		n = 1;
+	if (n > PARALLELMAX)
+		n = PARALLELMAX;
+	parallelthreads = n;
+}
+
+int GetParallelThreads(void)
+{
+	return(parallelthreads);
+}
+
+void MarkParallelWorker(void)
+{
+	parallelworker = TRUE;
+}
+
+static void *ParallelTask(void *arg)
+{
+	PARALLELTASK *task = arg;
+	
+	parallelworker = TRUE;
+	task->func(task->start,task->end,task->arg);
+	return(NULL);
+}
+
+/*
+ Call func(start,end,arg) on contiguous blocks covering 0 to n-1, one 
+ block per thread, and return when all are done. The calling thread 
+ does the first block. func must only write to its own block.
+ */
+void ParallelFor(int n,void (*func)(int,int,void *),void *arg)
+{
+	int i,nthreads,wasworker;
+	pthread_t threads[PARALLELMAX];
+	PARALLELTASK tasks[PARALLELMAX];
+	
+	nthreads = parallelthreads;
+	if (nthreads > n)
+		nthreads = n;
+	if (parallelworker || nthreads <= 1) {
+		if (n > 0)
+			func(0,n,arg);
+		return;
+	}
+	for (i=0;i<nthreads;i++) {
+		tasks[i].func  = func;
+		tasks[i].arg   = arg;
+		tasks[i].start = (int)((long)n * i / nthreads);
+		tasks[i].end   = (int)((long)n * (i+1) / nthreads);
+	}
+	for (i=1;i<nthreads;i++) {
+		if (pthread_create(&threads[i],NULL,ParallelTask,&tasks[i]) != 0) {
+			func(tasks[i].start,tasks[i].end,arg);
+			tasks[i].func = NULL;
+		}
+	}
+	wasworker = parallelworker;
+	parallelworker = TRUE;
+	func(tasks[0].start,tasks[0].end,arg);
+	parallelworker = wasworker;
+	for (i=1;i<nthreads;i++) {
+		if (tasks[i].func != NULL)
+			pthread_join(threads[i],NULL);
+	}
+}
+
+/*
+ Return the number of an automatically named image "prefix%04d.ext",
+ at or after from, that does not exist yet. The search doubles its step
+ and then bisects, rather than opening every file in turn, so if the 
+ existing frames have gaps the number is free but may not be the first.
+ */
+int FirstFreeImage(char *prefix,int from,char *ext)
+{
+	int lo,hi,mid,step = 1;
+	
+	if (!ImageExists(prefix,from,ext))
+		return(from);
+	lo = from;
+	hi = from + 1;
+	while (ImageExists(prefix,hi,ext)) {
+		lo = hi;
+		step *= 2;
+		hi = from + step;
+	}
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+		if (ImageExists(prefix,mid,ext))
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return(hi);
+}
+
+/*
+ Return the number of the first free frame at or after from, for which
+ neither the image nor, in stereo, the L_ and R_ images exist. Cheap
+ to call for every frame: a free number costs one or two opens.
+ */
+int FirstFreeFrame(int stereo,int from,char *ext)
+{
+	for (;;) {
+		from = FirstFreeImage(stereo ? "L_" : "",from,ext);
+		if (!stereo || !ImageExists("R_",from,ext))
+			return(from);
+		from++;
+	}
+}
+
+/*
+ Does the automatically numbered image "prefix%04d.ext" exist
+ */
+int ImageExists(char *prefix,int n,char *ext)
+{
+	FILE *fptr;
+	char fname[64];
+	
+	sprintf(fname,"%s%04d.%s",prefix,n,ext);
+	if ((fptr = fopen(fname,"rb")) == NULL)
+		return(FALSE);
+	fclose(fptr);
+	return(TRUE);
+}
+
 /*
  Write the current view to an image file
  Do the right thing for stereo, ie: two images
@@ -514,8 +649,11 @@ int WindowDump(char *name,int width,int height,int stereo,int format)
 		case 7: strcpy(ext,"eps"); break;
 		case 8: strcpy(ext,"raw"); break;
 		case 9: strcpy(ext,"bmp"); break;
+		case 14: strcpy(ext,"png"); break;
+		case 15: strcpy(ext,"png"); break;
 	}
 	if (strlen(name) <= 0) {
+		counter = FirstFreeFrame(stereo,counter,ext);
 		if (stereo)
 			sprintf(fname,"L_%04d.%s",counter,ext);
 		else
@@ -526,14 +664,6 @@ int WindowDump(char *name,int width,int height,int stereo,int format)
 		else
 			sprintf(fname,"%s.%s",name,ext);
 	}
-	while (strlen(name) <= 0 && (fptr = fopen(fname,"rb")) != NULL) {
-		counter++;
-		fclose(fptr);
-		if (stereo)
-			sprintf(fname,"L_%04d.%s",counter,ext);
-		else
-			sprintf(fname,"%04d.%s",counter,ext);
-	}
 	if ((fptr = fopen(fname,"wb")) == NULL) {
 		fprintf(stderr,"WindowDump - Failed to open file for window dump\n");
 		return(FALSE);
@@ -555,11 +685,6 @@ int WindowDump(char *name,int width,int height,int stereo,int format)
 		} else {
 			sprintf(fname,"R_%s.%s",name,ext);
 		}
-		while (strlen(name) <= 0 && (fptr = fopen(fname,"rb")) != NULL) {
-			counter++;
-			fclose(fptr);
-			sprintf(fname,"R_%04d.%s",counter,ext);
-		}
 		if ((fptr = fopen(fname,"wb")) == NULL) {
 			fprintf(stderr,"WindowDump - Failed to open file for window dump\n");
 			return(FALSE);
@@ -37,6 +37,7 @@ int main(int argc,char **argv)
 {
   SetDefaults();
   ParseCommandLine(argc,argv);
+  SetParallelThreads(options.threads);
 
   /** Call appropriate routines to populate data structure. */
   if (qwdata.compute == TRUE) {
@@ -51,8 +52,30 @@ int main(int argc,char **argv)
       fprintf(stderr,"main: error reading .qwml file\n");
   }
 
-  if (graph.graphvizlayout)
-    LayoutGraph(&graph);
+  /** A search or start sweep only prints its table */
+  if (qwparam.sweep != NULL || qwparam.startsweep != NULL) {
+    FreeAdjacency(&graph);
+    FreeNeighbourLists(&graph);
+    return(0);
+  }
+
+  /** Time the layouts and the walk of an .adj file and stop */
+  if (options.bench && !options.offscreen && qwdata.compute == TRUE) {
+    BenchmarkLayout(&graph);
+    BenchmarkWalk(&graph,&qwdata,&qwparam);
+    BenchmarkFused(&graph,&qwparam);
+    BenchmarkReorder(&graph);
+    FreeAdjacency(&graph);
+    FreeNeighbourLists(&graph);
+    FreeQWprob(&qwdata,&graph);
+    return(0);
+  }
+
+  /** A window opens at once and the layout is animated as it runs */
+  if (graph.graphvizlayout && !options.poster && !options.offscreen)
+    StartBackgroundLayout(&graph);
+  else if (graph.graphvizlayout)
+    CachedLayoutGraph(&graph);
   else 
     ScaleCoordinatesFromFile(&graph);
 
@@ -61,6 +84,26 @@ int main(int argc,char **argv)
     options.showarrow = TRUE;
   }
 
+  /** Render one very large image without opening a window */
+  if (options.poster) {
+    RenderPoster();
+    FreeAdjacency(&graph);
+    FreeNeighbourLists(&graph);
+    FreeCoordinateLists(&graph);
+    FreeQWprob(&qwdata,&graph);
+    return(0);
+  }
+
+  /** Render every time step to image files without opening a window */
+  if (options.offscreen) {
+    RenderOffscreen();
+    FreeAdjacency(&graph);
+    FreeNeighbourLists(&graph);
+    FreeCoordinateLists(&graph);
+    FreeQWprob(&qwdata,&graph);
+    return(0);
+  }
+
   SetupWindow(argc,argv);
   CreateWindowAndHandlers();
   CreateEnvironment();
@@ -87,6 +130,7 @@ int main(int argc,char **argv)
   
   /** Free Adjacency and CoordinateLists */
   FreeAdjacency(&graph);
+  FreeNeighbourLists(&graph);
   FreeCoordinateLists(&graph);
   FreeQWprob(&qwdata,&graph);
   return(0);
@@ -108,6 +152,8 @@ void SetDefaults(void)
   options.record       = FALSE;
   options.windowdump   = FALSE;
   options.exporttiff   = FALSE;
+  options.exportpng    = FALSE;
+  options.streamname[0] = '\0';
   options.fullscreen   = FALSE;
   options.targetfps    = 60;
   options.showinfo     = TRUE;
@@ -119,6 +165,23 @@ void SetDefaults(void)
   options.labelledvertex  = 0;
   options.subframes    = 1;
   options.colourscheme = 1;
+  options.offscreen    = FALSE;
+  options.bench        = FALSE;
+  options.supersample  = 1;
+  options.poster       = FALSE;
+  options.postertime   = -1;
+  options.cache        = TRUE;
+  options.cachelimit   = QWCACHELIMIT;
+  options.localradius  = FALSE;
+  if (getenv("QWVIZ_CACHE") != NULL)
+    snprintf(options.cachedir,256,"%s",getenv("QWVIZ_CACHE"));
+  else if (getenv("HOME") != NULL)
+    snprintf(options.cachedir,256,"%s/.cache/qwViz",getenv("HOME"));
+  else
+    options.cachedir[0] = '\0';
+  options.threads      = sysconf(_SC_NPROCESSORS_ONLN);
+  if (options.threads < 1)
+    options.threads = 1;
 
   /** State of the input device, mouse in this case  */
   interfacestate.button = -1;
@@ -139,11 +202,17 @@ void SetDefaults(void)
   graph.noderadius = 0.0;
   graph.graphvizlayout = TRUE;
   graph.firstrender = TRUE;
+  graph.nbrstart = NULL;
+  graph.nbr = NULL;
+  graph.reverse = NULL;
+  graph.radiusscale = NULL;
+  graph.order = NULL;
   graph.layoutalgorithm = malloc(64*sizeof(char));
   strcpy(graph.layoutalgorithm,"neato");
 
   /** qwdata initialisation  */
   qwdata.steps = 200;      
+  qwdata.stride = 1;
   qwdata.prob = NULL;
   qwdata.comment = NULL;
   qwdata.maxprob = 0.01;
@@ -154,6 +223,14 @@ void SetDefaults(void)
   qwparam.marked = -1;      
   qwparam.start  = 0;      
   qwparam.write = FALSE;   
+  qwparam.sweep = NULL;
+  qwparam.startsweep = NULL;
+  qwparam.symmetry = FALSE;
+  qwparam.reorder = FALSE;
+  qwparam.checkpoint = 0;
+  qwparam.resume = FALSE;
+  qwparam.renormalise = FALSE;
+  qwparam.checkpointfile[0] = '\0';
  
   /** qwfile initialisation */
   qwfile.in = NULL;
@@ -204,14 +281,82 @@ void ParseCommandLine(int argc, char **argv)
       strcpy(graph.layoutalgorithm,"circo");
     if (strcmp(argv[i],"-fdp") == 0)
       strcpy(graph.layoutalgorithm,"fdp");
+    if (strcmp(argv[i],"-multilevel") == 0)
+      strcpy(graph.layoutalgorithm,"multilevel");
+    if (strcmp(argv[i],"-spectral") == 0)
+      strcpy(graph.layoutalgorithm,"spectral");
     if (strcmp(argv[i],"-tiff") == 0)
       options.exporttiff = TRUE;
+    if (strcmp(argv[i],"-png") == 0)
+      options.exportpng = TRUE;
+    if (strcmp(argv[i],"-y4m") == 0) {
+      if (i+1 >= argc) {
+	fprintf(stderr,"qwViz error: option -y4m needs a file name, or - for stdout.\n");
+	exit(-1);
+      }
+      strncpy(options.streamname,argv[i+1],255);
+      options.streamname[255] = '\0';
+    }
+    if (strcmp(argv[i],"-offscreen") == 0) {
+      options.offscreen = TRUE;
+      if (i+1 >= argc || sscanf(argv[i+1],"%dx%d",
+				&camera.screenwidth,&camera.screenheight) != 2
+	  || camera.screenwidth <= 0 || camera.screenheight <= 0) {
+	fprintf(stderr,"qwViz error: option -offscreen needs a size, \
+e.g. -offscreen 1920x1080.\n");
+	exit(-1);
+      }
+    }
+    if (strcmp(argv[i],"-poster") == 0) {
+      options.poster = TRUE;
+      if (i+1 >= argc || sscanf(argv[i+1],"%dx%d",
+				&options.posterwidth,&options.posterheight) != 2
+	  || options.posterwidth <= 0 || options.posterheight <= 0) {
+	fprintf(stderr,"qwViz error: option -poster needs a size, \
+e.g. -poster 16384x16384.\n");
+	exit(-1);
+      }
+      if (i+2 < argc-1 && isdigit(argv[i+2][0]))
+	options.postertime = atoi(argv[i+2]);
+    }
+    if (strcmp(argv[i],"-supersample") == 0) {
+      if (i+1 >= argc || (options.supersample = atoi(argv[i+1])) < 1) {
+	fprintf(stderr,"qwViz error: option -supersample needs a positive integer.\n");
+	exit(-1);
+      }
+    }
+    if (strcmp(argv[i],"-bench") == 0)
+      options.bench = TRUE;
+    if (strcmp(argv[i],"-localradius") == 0)
+      options.localradius = TRUE;
+    if (strcmp(argv[i],"-nocache") == 0)
+      options.cache = FALSE;
+    if (strcmp(argv[i],"-cachedir") == 0) {
+      if (i+1 >= argc) {
+	fprintf(stderr,"qwViz error: option -cachedir needs a directory.\n");
+	exit(-1);
+      }
+      snprintf(options.cachedir,256,"%s",argv[i+1]);
+    }
+    if (strcmp(argv[i],"-cachelimit") == 0) {
+      if (i+1 >= argc || (options.cachelimit = atoi(argv[i+1])) < 0) {
+	fprintf(stderr,"qwViz error: option -cachelimit needs a size in MB.\n");
+	exit(-1);
+      }
+    }
+    if (strcmp(argv[i],"-threads") == 0) {
+      if (i+1 >= argc || (options.threads = atoi(argv[i+1])) < 1) {
+	fprintf(stderr,"qwViz error: option -threads needs a positive integer.\n");
+	exit(-1);
+      }
+    }
   }
   /** Read the filename and type from the command line. 
      If adjacency file is given then check command line for 
      quantum walk options */
   if ( (qwfile.intype = ReadFilename(argc,argv,&qwfile)) == 'a') {
     qwdata.compute = TRUE;
+    snprintf(qwparam.checkpointfile,512,"%s.ckpt",qwfile.in);
     for (i=1;i<argc-1;i++) {
       if (strcmp(argv[i],"-search") == 0) {
 	qwparam.procedure = 's';
@@ -229,8 +374,36 @@ void ParseCommandLine(int argc, char **argv)
 -search are not compatible.\n");
 	  exit(-1);
 	}
+      } else if (strcmp(argv[i],"-sweep") == 0) {
+	qwparam.procedure = 's';
+	qwparam.sweep = argv[i+1];
+	if (qwparam.start != 0) {
+	  fprintf(stderr,"qwViz error: options -start and \
+-sweep are not compatible.\n");
+	  exit(-1);
+	}
+      } else if (strcmp(argv[i],"-startsweep") == 0) {
+	qwparam.startsweep = argv[i+1];
+      } else if (strcmp(argv[i],"-symmetry") == 0) {
+	qwparam.symmetry = TRUE;
+      } else if (strcmp(argv[i],"-reorder") == 0) {
+	qwparam.reorder = TRUE;
+      } else if (strcmp(argv[i],"-checkpoint") == 0) {
+	if ((qwparam.checkpoint = atoi(argv[i+1])) < 1) {
+	  fprintf(stderr,"qwViz error: option -checkpoint needs a positive integer.\n");
+	  exit(-1);
+	}
+      } else if (strcmp(argv[i],"-resume") == 0) {
+	qwparam.resume = TRUE;
+      } else if (strcmp(argv[i],"-renormalise") == 0) {
+	qwparam.renormalise = TRUE;
       } else if (strcmp(argv[i],"-steps") == 0) {
 	qwdata.steps = atoi(argv[i+1]);
+      } else if (strcmp(argv[i],"-stride") == 0) {
+	if ((qwdata.stride = atoi(argv[i+1])) < 1) {
+	  fprintf(stderr,"qwViz error: option -stride needs a positive integer.\n");
+	  exit(-1);
+	}
       } else if (strcmp(argv[i],"-o") == 0) {
 	qwparam.write = TRUE;
 	qwfile.out = argv[i+1];
@@ -242,6 +415,19 @@ void ParseCommandLine(int argc, char **argv)
 	  qwfile.outtype = 'r';
       }
     }
+    if (qwparam.startsweep != NULL && (qwparam.procedure == 's' || qwparam.start != 0)) {
+      fprintf(stderr,"qwViz error: option -startsweep is not compatible with \
+-start, -search or -sweep.\n");
+      exit(-1);
+    }
+    if (qwparam.startsweep != NULL && qwparam.write == TRUE && qwfile.outtype != 'r') {
+      fprintf(stderr,"qwViz error: option -startsweep only writes .prob files.\n");
+      exit(-1);
+    }
+    /** From here on qwdata.steps counts the stored probabilities,
+	at walk steps 0, stride, 2*stride, ... */
+    qwdata.walksteps = qwdata.steps;
+    qwdata.steps = (qwdata.steps + qwdata.stride - 1) / qwdata.stride;
   } else if ( qwfile.intype == 'q' ) {
     qwdata.compute = FALSE;
   } else {
@@ -286,9 +472,16 @@ void CreateWindowAndHandlers(void)
 */
 void CreateEnvironment(void)
 {
+  GLfloat black[4] = {0.0,0.0,0.0,0.0};
+  GLfloat white[4] = {1.0,1.0,1.0,1.0};
+  GLfloat midgrey[4] = {0.2,0.2,0.2,1.0};
+  GLfloat noshin[1] = {30}; 
+
+  InvalidateGLState();
+
   /** Miscellaneous settings  */
   glDisable(GL_CULL_FACE);
-  glEnable(GL_DEPTH_TEST);
+  SetGLCapability(GL_DEPTH_TEST,TRUE);
   glEnable(GL_BLEND);
   glBlendFunc(GL_SRC_ALPHA,GL_ONE_MINUS_SRC_ALPHA);
   glPixelStorei(GL_UNPACK_ALIGNMENT,1);
@@ -314,8 +507,8 @@ void CreateEnvironment(void)
   glEnable(GL_COLOR_MATERIAL);
 
   /** Turn off all the lights  */
-  glDisable(GL_LIGHT0);
-  glDisable(GL_LIGHT1);
+  SetGLCapability(GL_LIGHT0,FALSE);
+  SetGLCapability(GL_LIGHT1,FALSE);
   glDisable(GL_LIGHT2);
   glDisable(GL_LIGHT3);
   glDisable(GL_LIGHT4);
@@ -325,44 +518,42 @@ void CreateEnvironment(void)
   glLightModeli(GL_LIGHT_MODEL_LOCAL_VIEWER,GL_TRUE);
   glLightModeli(GL_LIGHT_MODEL_TWO_SIDE,GL_FALSE);
   glClearColor(options.bgcolour.r,options.bgcolour.g,options.bgcolour.b,0.0);
+
+  /** The colours of the two lights, these never change */
+  glLightfv(GL_LIGHT0,GL_DIFFUSE,white);
+  glLightfv(GL_LIGHT0,GL_SPECULAR,white);
+  glLightfv(GL_LIGHT0,GL_AMBIENT,black);
+  glLightfv(GL_LIGHT1,GL_DIFFUSE,white);
+  glLightfv(GL_LIGHT1,GL_SPECULAR,white);
+  glLightfv(GL_LIGHT1,GL_AMBIENT,black);
+
+  /** The global shading settings */
+  glLightModelfv(GL_LIGHT_MODEL_AMBIENT,midgrey);
+  glMaterialfv(GL_FRONT_AND_BACK,GL_SPECULAR,white);
+  glMaterialfv(GL_FRONT_AND_BACK,GL_SHININESS,noshin);
 }
 
+/**
+   Position the two lights. The positions are transformed by the current
+   modelview matrix, so this is called once per frame (and per eye) after
+   the camera is set. Everything else about the lights is fixed in 
+   CreateEnvironment.
+*/
 void CreateLighting(void)
 {
   GLfloat p[4] = {0,0,0,1};
-  GLfloat black[4] = {0.0,0.0,0.0,0.0};
-  GLfloat white[4] = {1.0,1.0,1.0,1.0};
-  GLfloat midgrey[4] = {0.2,0.2,0.2,1.0};
-  GLfloat noshin[1] = {30}; 
 
-  /** Create two lights */
   p[0] = -10.0 ;
   p[1] = 10.0 ; 
   p[2] = 10.0 ; 
   glLightfv(GL_LIGHT0,GL_POSITION,p);
-  glLightfv(GL_LIGHT0,GL_DIFFUSE,white);
-  glLightfv(GL_LIGHT0,GL_SPECULAR,white);
-  glLightfv(GL_LIGHT0,GL_AMBIENT,black);
-  glEnable(GL_LIGHT0);
+  SetGLCapability(GL_LIGHT0,TRUE);
 
   p[0] = 10.0 ;
   p[1] = -10. ;
   p[2] = 5.0 ; 
   glLightfv(GL_LIGHT1,GL_POSITION,p);
-  glLightfv(GL_LIGHT1,GL_DIFFUSE,white);
-  glLightfv(GL_LIGHT1,GL_SPECULAR,white);
-  glLightfv(GL_LIGHT1,GL_AMBIENT,black);
-  glEnable(GL_LIGHT1);
-
-  /** The global shading settings */
-  glShadeModel(GL_FLAT);
-  glPolygonMode(GL_FRONT_AND_BACK,GL_FILL); /** Filled rather than wireframe */
-  glLightModelfv(GL_LIGHT_MODEL_AMBIENT,midgrey);
-  glShadeModel(GL_SMOOTH);
-  glEnable(GL_LIGHTING); /** Turn on light calculations */
-
-  glMaterialfv(GL_FRONT_AND_BACK,GL_SPECULAR,white);
-  glMaterialfv(GL_FRONT_AND_BACK,GL_SHININESS,noshin);
+  SetGLCapability(GL_LIGHT1,TRUE);
 }
 
 /**
@@ -377,12 +568,15 @@ void HandleDisplay(void)
   XYZ r;
   double ratio,radians,wd2,ndfl;
   double left,right,top,bottom;
+  static GLuint framelist = 0;
 
   if (options.record)
     options.targetfps = 30;
   else
     options.targetfps = 60;
 
+  StartGLStateFrame();
+
   /** Misc stuff needed for the frustum  */
   ratio   = camera.screenwidth / (double)camera.screenheight;
   if (camera.stereo == DUALSTEREO)
@@ -402,6 +596,17 @@ void HandleDisplay(void)
 
   if (camera.stereo == ACTIVESTEREO || camera.stereo == DUALSTEREO) {
 
+    /** Build the geometry and colours for this frame once into a display
+	list, then replay it for each eye with only the projection changed. */
+    if (framelist == 0)
+      framelist = glGenLists(1);
+    InvalidateGLState();
+    glNewList(framelist,GL_COMPILE);
+    CreateLighting();
+    CreateGeometry(interfacestate.currenttime, interfacestate.currentsubframe, &graph, &qwdata);
+    DrawExtras(interfacestate, &qwdata);
+    glEndList();
+
     if (camera.stereo == DUALSTEREO) {
       glDrawBuffer(GL_BACK);
       glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -426,8 +631,7 @@ void HandleDisplay(void)
 	      camera.vp.y + r.y + camera.vd.y,
 	      camera.vp.z + r.z + camera.vd.z,
 	      camera.vu.x,camera.vu.y,camera.vu.z);
-    CreateGeometry(interfacestate.currenttime, interfacestate.currentsubframe, &graph, &qwdata);
-    DrawExtras(interfacestate, &qwdata);
+    glCallList(framelist);
 
     glMatrixMode(GL_PROJECTION);
     glLoadIdentity();
@@ -448,8 +652,7 @@ void HandleDisplay(void)
 	      camera.vp.y - r.y + camera.vd.y,
 	      camera.vp.z - r.z + camera.vd.z,
 	      camera.vu.x,camera.vu.y,camera.vu.z);
-    CreateGeometry(interfacestate.currenttime, interfacestate.currentsubframe, &graph, &qwdata);
-    DrawExtras(interfacestate, &qwdata);
+    glCallList(framelist);
 
   } else {
 
@@ -468,26 +671,21 @@ void HandleDisplay(void)
 	      camera.vp.y + camera.vd.y,
 	      camera.vp.z + camera.vd.z,
 	      camera.vu.x,camera.vu.y,camera.vu.z);
+    CreateLighting();
     CreateGeometry(interfacestate.currenttime, interfacestate.currentsubframe, &graph, &qwdata);
     DrawExtras(interfacestate, &qwdata);
   }
 
-  /** Dump the window in compressed TGA format  */
-  if (options.record || options.windowdump) {
-    if (options.exporttiff) {
-      if (camera.stereo == ACTIVESTEREO)
-	WindowDump("",camera.screenwidth,camera.screenheight,TRUE,-5);
-      else
-	WindowDump("",camera.screenwidth,camera.screenheight,FALSE,-5);
-      options.windowdump = FALSE;
-    } else {
-      if (camera.stereo == ACTIVESTEREO)
-	WindowDump("",camera.screenwidth,camera.screenheight,TRUE,12);
-      else
-	WindowDump("",camera.screenwidth,camera.screenheight,FALSE,12);
-      options.windowdump = FALSE;
-    }
+  /** Dump the window in compressed TGA format. Recordings read back 
+      asynchronously and are written by the encoder thread. */
+  if (options.record) {
+    RecordFrame(camera.screenwidth,camera.screenheight,
+		camera.stereo == ACTIVESTEREO,ImageFormat());
+  } else if (options.windowdump) {
+    WindowDump("",camera.screenwidth,camera.screenheight,
+	       camera.stereo == ACTIVESTEREO,ImageFormat());
   }
+  options.windowdump = FALSE;
 
   /** Swap buffers  */
   glutSwapBuffers();
@@ -517,6 +715,7 @@ void HandleKeyboard(unsigned char key, int x, int y)
   case ESC: 		
   case 'Q':
   case 'q': 
+    FinishRecording();
     exit(0);
     break;
   case 'a':
@@ -550,6 +749,8 @@ void HandleKeyboard(unsigned char key, int x, int y)
   case 'r':
   case 'R':
     options.record = !options.record;
+    if (!options.record)
+      FinishRecording();
     break;
   case '<':
   case ',':
@@ -873,6 +1074,7 @@ void HandleIdle(void)
   movietstop = tstop;
 
   if (tstop - tstart > 1.0/options.targetfps) {
+    AnimateLayout(&graph);
     glutPostRedisplay();
     tstart = tstop;
   }
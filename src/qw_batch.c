@@ -0,0 +1,279 @@
+/*=======================================================================
+   qwViz - OpenGL visualisation of quantum walks on graphs
+  -----------------------------------------------------------------------
+    Copyright (C) 2011 Scott D. Berry
+    Contact: scottdberry 'at' gmail
+
+    This file is part of qwViz.
+
+    qwViz is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qwViz is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qwViz.  If not, see <http://www.gnu.org/licenses/>.
+  ========================================================================*/
+#include "qwViz.h"
+
+/**
+   qw_batch.c propagates WALKLANES independent walks on the same graph
+   at once. The amplitudes are stored by arc and then by walk,
+   amp[a*WALKLANES + k], so the neighbour lists are read once for all
+   the walks, and every operation on an arc is a short loop over the
+   walks of fixed length that the compiler turns into vector
+   instructions. On x86-64 Linux the kernels are built for AVX-512,
+   AVX2 and plain SSE2, and the best one for the processor is chosen
+   when the program starts.
+   Each walk has its own marked vertex (-1 for none), so one batch can
+   hold the searches of a sweep or walks from different vertices.
+   ====================================================================
+*/
+
+extern OPTIONS options;
+
+void MallocWalkBatch(WALKBATCH *batch, GRAPH *graph)
+{
+  int arcs, k;
+
+  BuildNeighbourLists(graph);
+  arcs = (*graph).nbrstart[(*graph).nodes];
+  if (arcs < 1)
+    arcs = 1;
+  (*batch).graph = graph;
+  (*batch).amp = malloc(arcs * WALKLANES * sizeof(double));
+  (*batch).next = malloc(arcs * WALKLANES * sizeof(double));
+  if ((*batch).amp == NULL || (*batch).next == NULL) {
+    fprintf(stderr,"MallocWalkBatch: Memory allocation failed.\n");
+    exit(-1);
+  }
+  for (k = 0; k < WALKLANES; k++)
+    (*batch).marked[k] = -1;
+}
+
+void FreeWalkBatch(WALKBATCH *batch)
+{
+  free((*batch).amp);
+  (*batch).amp = NULL;
+  free((*batch).next);
+  (*batch).next = NULL;
+}
+
+/**
+   BatchEqualSuperposition starts every walk in the state of
+   InitialiseEqualSuperposition.
+*/
+void BatchEqualSuperposition(WALKBATCH *batch)
+{
+  GRAPH *graph = (*batch).graph;
+  int i, a, k, d, n = (*graph).nodes;
+  double v;
+
+  for (i = 0; i < n; i++) {
+    d = (*graph).nbrstart[i+1] - (*graph).nbrstart[i];
+    v = sqrt(1.0/((double)d*n));
+    for (a = (*graph).nbrstart[i]; a < (*graph).nbrstart[i+1]; a++)
+      for (k = 0; k < WALKLANES; k++)
+	(*batch).amp[a*WALKLANES + k] = v;
+  }
+}
+
+/**
+   BatchSingleVertex starts walk k at vertex start[k], in the state of
+   InitialiseSingleVertex.
+*/
+void BatchSingleVertex(WALKBATCH *batch, int *start)
+{
+  GRAPH *graph = (*batch).graph;
+  int a, k, s, arcs = (*graph).nbrstart[(*graph).nodes];
+
+  memset((*batch).amp,0,arcs * WALKLANES * sizeof(double));
+  for (k = 0; k < WALKLANES; k++) {
+    s = start[k];
+    for (a = (*graph).nbrstart[s]; a < (*graph).nbrstart[s+1]; a++)
+      (*batch).amp[a*WALKLANES + k] = sqrt(1.0/((*graph).nbrstart[s+1] - (*graph).nbrstart[s]));
+  }
+}
+
+/**
+   BatchStep applies the coin (Grover, or -I at the marked vertex of
+   each walk) and then the shift to all the walks.
+*/
+WALKKERNEL
+void BatchStep(WALKBATCH *batch)
+{
+  GRAPH *graph = (*batch).graph;
+  int *nbrstart = (*graph).nbrstart, *reverse = (*graph).reverse;
+  int i, a, k, d, n = (*graph).nodes;
+  double * restrict amp = (*batch).amp;
+  double * restrict next = (*batch).next;
+  double sum[WALKLANES], factor[WALKLANES], *swap;
+
+  for (i = 0; i < n; i++) {
+    d = nbrstart[i+1] - nbrstart[i];
+    if (d == 0)
+      continue;
+    /** Grover is 2/d times the sum less the amplitude, and -I is the
+	same with a factor of 0 */
+    for (k = 0; k < WALKLANES; k++) {
+      factor[k] = ((*batch).marked[k] == i) ? 0.0 : 2.0/d;
+      sum[k] = 0.0;
+    }
+    for (a = nbrstart[i]; a < nbrstart[i+1]; a++)
+      for (k = 0; k < WALKLANES; k++)
+	sum[k] += amp[a*WALKLANES + k];
+    for (k = 0; k < WALKLANES; k++)
+      sum[k] *= factor[k];
+    for (a = nbrstart[i]; a < nbrstart[i+1]; a++)
+      for (k = 0; k < WALKLANES; k++)
+	amp[a*WALKLANES + k] = sum[k] - amp[a*WALKLANES + k];
+  }
+
+  for (a = 0; a < nbrstart[n]; a++) {
+    if (reverse[a] < 0) {
+      for (k = 0; k < WALKLANES; k++)
+	next[a*WALKLANES + k] = 0.0;
+      continue;
+    }
+    for (k = 0; k < WALKLANES; k++)
+      next[a*WALKLANES + k] = amp[reverse[a]*WALKLANES + k];
+  }
+  swap = (*batch).amp;
+  (*batch).amp = (*batch).next;
+  (*batch).next = swap;
+}
+
+/**
+   BatchProbabilities sets prob[i*WALKLANES + k] to the probability of
+   finding walk k at vertex i.
+*/
+WALKKERNEL
+void BatchProbabilities(WALKBATCH *batch, double *prob)
+{
+  GRAPH *graph = (*batch).graph;
+  int i, a, k, n = (*graph).nodes;
+  double * restrict amp = (*batch).amp;
+  double p[WALKLANES];
+
+  for (i = 0; i < n; i++) {
+    for (k = 0; k < WALKLANES; k++)
+      p[k] = 0.0;
+    for (a = (*graph).nbrstart[i]; a < (*graph).nbrstart[i+1]; a++)
+      for (k = 0; k < WALKLANES; k++)
+	p[k] += amp[a*WALKLANES + k] * amp[a*WALKLANES + k];
+    for (k = 0; k < WALKLANES; k++)
+      prob[i*WALKLANES + k] = p[k];
+  }
+}
+
+/**
+   BatchVertexProbability is the probability of finding walk k at
+   vertex i.
+*/
+double BatchVertexProbability(WALKBATCH *batch, int k, int i)
+{
+  GRAPH *graph = (*batch).graph;
+  int a;
+  double p = 0.0;
+
+  for (a = (*graph).nbrstart[i]; a < (*graph).nbrstart[i+1]; a++)
+    p += (*batch).amp[a*WALKLANES + k] * (*batch).amp[a*WALKLANES + k];
+  return(p);
+}
+
+/**
+   BenchmarkWalk times one step of the walk from -start three ways: the
+   space matrix of QuantumWalk, walks over arcs one at a time as in
+   SearchPeak, and batches of WALKLANES walks, and prints how many
+   vertex steps (one walk at one vertex for one step) each manages per
+   second. The batched probabilities are checked against QuantumWalk.
+*/
+void BenchmarkWalk(GRAPH *graph, QWDATA *qwdata, QWPARAM *qwparam)
+{
+  WALKBATCH batch;
+  MATDBL space = NULL;
+  QWWORKSPACE work;
+  QWPARAM param = *qwparam;
+  int n = (*graph).nodes, arcs, i, j, k, t, steps, start[WALKLANES], peaktime;
+  double tstart, seconds, *prob, *amp, *next, peak, err = 0, p;
+
+  BuildNeighbourLists(graph);
+  arcs = (*graph).nbrstart[n];
+  fprintf(stderr,"BenchmarkWalk: %d vertices, %d arcs, %d lanes per batch\n",
+	  n,arcs,WALKLANES);
+  fprintf(stderr,"%12s %10s %10s %14s\n","engine","steps","seconds","vertex steps/s");
+
+  /** The space matrix of QuantumWalk, for a few steps */
+  param.procedure = 'w';
+  param.marked = n;
+  steps = (n > 1000) ? 5 : 50;
+  MallocMatDbl(&space,n,n);
+  MallocWorkspace(&work,graph);
+  InitialiseSingleVertex(&space,graph,&param);
+  tstart = GetRunTime();
+  for (t = 0; t < steps; t++) {
+    CoinOperation(&space,graph,&param,&work);
+    TranslationOperation(&space,graph,&work);
+  }
+  seconds = GetRunTime() - tstart;
+  fprintf(stderr,"%12s %10d %10.3f %14.3e\n","matrix",steps,seconds,(double)n*steps/seconds);
+
+  /** Batched walks from WALKLANES starts, checked against the matrix */
+  MallocWalkBatch(&batch,graph);
+  for (k = 0; k < WALKLANES; k++)
+    start[k] = ((*qwparam).start + k) % n;
+  BatchSingleVertex(&batch,start);
+  for (t = 0; t < steps; t++)
+    BatchStep(&batch);
+  for (i = 0; i < n; i++) {
+    p = 0.0;
+    for (j = 0; j < n; j++)
+      p += space[i][j]*space[i][j];
+    if (fabs(p - BatchVertexProbability(&batch,0,i)) > err)
+      err = fabs(p - BatchVertexProbability(&batch,0,i));
+  }
+  FreeWorkspace(&work);
+  FreeMatDbl(&space,n);
+
+  steps = (int)(2e7 / (arcs > 0 ? arcs : 1) / WALKLANES) + 1;
+  prob = malloc(n * WALKLANES * sizeof(double));
+  if (prob == NULL) {
+    fprintf(stderr,"BenchmarkWalk: Memory allocation failed.\n");
+    exit(-1);
+  }
+
+  /** One walk at a time over the arcs, as the searches of a sweep */
+  amp = malloc((arcs > 0 ? arcs : 1) * sizeof(double));
+  next = malloc((arcs > 0 ? arcs : 1) * sizeof(double));
+  if (amp == NULL || next == NULL) {
+    fprintf(stderr,"BenchmarkWalk: Memory allocation failed.\n");
+    exit(-1);
+  }
+  tstart = GetRunTime();
+  for (k = 0; k < WALKLANES; k++)
+    SearchPeak(graph,k % n,steps,amp,next,&peak,&peaktime);
+  seconds = GetRunTime() - tstart;
+  fprintf(stderr,"%12s %10d %10.3f %14.3e\n","arcs",steps*WALKLANES,seconds,
+	  (double)n*steps*WALKLANES/seconds);
+  free(amp);
+  free(next);
+
+  /** The same number of walks as one batch */
+  BatchSingleVertex(&batch,start);
+  tstart = GetRunTime();
+  for (t = 0; t < steps; t++) {
+    BatchProbabilities(&batch,prob);
+    BatchStep(&batch);
+  }
+  seconds = GetRunTime() - tstart;
+  fprintf(stderr,"%12s %10d %10.3f %14.3e\n","batch",steps*WALKLANES,seconds,
+	  (double)n*steps*WALKLANES/seconds);
+  fprintf(stderr,"BenchmarkWalk: largest difference from the matrix walk %.2e\n",err);
+  free(prob);
+  FreeWalkBatch(&batch);
+}
@@ -0,0 +1,338 @@
+/*=======================================================================
+   qwViz - OpenGL visualisation of quantum walks on graphs
+  -----------------------------------------------------------------------
+    Copyright (C) 2011 Scott D. Berry
+    Contact: scottdberry 'at' gmail
+
+    This file is part of qwViz.
+
+    qwViz is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qwViz is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qwViz.  If not, see <http://www.gnu.org/licenses/>.
+  ========================================================================*/
+#include <sys/stat.h>
+#include <dirent.h>
+#include <utime.h>
+#include "qwViz.h"
+
+/**
+   qw_checkpoint.c saves a walk in progress (-checkpoint [int]) to the
+   .adj file name with .ckpt added, every so many steps and when the
+   walk finishes, and continues it from there with -resume. A resumed
+   walk may ask for more steps than the saved one had, which extends a
+   finished walk without starting again from t = 0.
+   A checkpoint is a CHECKPOINTHEADER, identifying the graph by
+   GraphHash and the walk by its procedure and vertices, then the
+   amplitude of every arc in the order of the neighbour lists after
+   steps steps, then for each vertex its probabilities for the steps
+   0, stride, 2*stride, ... before steps.
+   Finished walks are also kept in options.cachedir, beside the cached
+   layouts (qw_layoutcache.c), in the same format, so that running the
+   same walk again reads it instead, and a longer run of it carries on
+   from the end of the cached one. -nocache turns this off. The cached
+   walks are kept under -cachelimit MB by removing the least recently
+   used, and a walk bigger than that is not cached at all.
+   ====================================================================
+*/
+
+extern OPTIONS options;
+
+/**
+   CheckpointDue is TRUE if the walk should be saved after t of its
+   steps, as a checkpoint or in the cache.
+*/
+int CheckpointDue(QWDATA *qwdata, QWPARAM *qwparam, int t)
+{
+  if ((*qwparam).checkpoint > 0 && t % (*qwparam).checkpoint == 0)
+    return(TRUE);
+  return(((*qwparam).checkpoint > 0 || (*qwparam).resume == TRUE || WalkCacheOn()) &&
+	 t == (*qwdata).steps * (*qwdata).stride);
+}
+
+/**
+   ReadCheckpoint fills state with the amplitudes of the arcs and
+   qwdata.prob with the probabilities of the walk so far, from the
+   checkpoint if qwparam.resume is set, or from the cache if it has
+   more steps. Returns the number of steps restored, at most
+   qwdata.steps * qwdata.stride, or 0 if the walk starts at t = 0.
+*/
+int ReadCheckpoint(GRAPH *graph, QWDATA *qwdata, QWPARAM *qwparam, double *state)
+{
+  char name[512];
+  int t = 0, cached;
+
+  if ((*qwparam).resume == TRUE) {
+    if (access((*qwparam).checkpointfile,F_OK) != 0)
+      fprintf(stderr,"ReadCheckpoint: No checkpoint \"%s\", starting from step 0.\n",
+	      (*qwparam).checkpointfile);
+    else if ((t = ReadWalkFile((*qwparam).checkpointfile,graph,qwdata,qwparam,state,0)) < 0)
+      return(0);
+  }
+  if (WalkCacheOn() && t < (*qwdata).steps * (*qwdata).stride) {
+    WalkCacheName(graph,qwdata,qwparam,name,512);
+    if ((cached = ReadWalkFile(name,graph,qwdata,qwparam,state,t)) < 0)
+      return(0);
+    if (cached > t) {
+      t = cached;
+      /** used, so last to be removed by TrimWalkCache */
+      utime(name,NULL);
+    }
+  }
+  if (options.debug == TRUE && t > 0)
+    fprintf(stderr,"ReadCheckpoint: Resuming at step %d of %d.\n",t,
+	    (*qwdata).steps * (*qwdata).stride);
+  return(t);
+}
+
+/**
+   WriteCheckpoint saves the walk after t steps, with the amplitudes of
+   the arcs in state, in the checkpoint if one is due, and in the cache
+   when the walk is finished.
+*/
+void WriteCheckpoint(GRAPH *graph, QWDATA *qwdata, QWPARAM *qwparam, double *state, int t)
+{
+  char name[512];
+  double size;
+
+  if ((*qwparam).checkpoint > 0 || (*qwparam).resume == TRUE)
+    if (((*qwparam).checkpoint > 0 && t % (*qwparam).checkpoint == 0) ||
+	t == (*qwdata).steps * (*qwdata).stride)
+      WriteWalkFile((*qwparam).checkpointfile,graph,qwdata,qwparam,state,t);
+  if (WalkCacheOn() && t == (*qwdata).steps * (*qwdata).stride) {
+    size = sizeof(CHECKPOINTHEADER) + (*graph).nbrstart[(*graph).nodes] * sizeof(double) +
+      (double)(*graph).nodes * (*qwdata).steps * sizeof(double);
+    if (size > options.cachelimit * 1048576.0) {
+      fprintf(stderr,"WriteCheckpoint: The walk is %.0f MB, over -cachelimit %d MB, not caching it.\n",
+	      size / 1048576.0,options.cachelimit);
+      return;
+    }
+    if (MakeCacheDirectory(options.cachedir) != 0)
+      return;
+    WalkCacheName(graph,qwdata,qwparam,name,512);
+    WriteWalkFile(name,graph,qwdata,qwparam,state,t);
+    TrimWalkCache(options.cachedir,options.cachelimit * 1048576.0,name);
+  }
+}
+
+/** WalkCacheOn is TRUE unless -nocache, or there is no cache directory */
+int WalkCacheOn(void)
+{
+  return(options.cache == TRUE && options.cachedir[0] != '\0');
+}
+
+/**
+   WalkCacheName writes the name of the cached walk into name, of
+   length size. The file is found by the hash of what decides the
+   walk: the graph, the procedure, the start and marked vertices, the
+   coin and the stride, but not the number of steps, so one file holds
+   the longest run and serves any shorter one.
+*/
+void WalkCacheName(GRAPH *graph, QWDATA *qwdata, QWPARAM *qwparam, char *name, int size)
+{
+  unsigned long long hash = GraphHash(graph);
+  int procedure = (*qwparam).procedure;
+
+  hash = HashBytes(hash,&procedure,sizeof(int));
+  hash = HashBytes(hash,&(*qwparam).start,sizeof(int));
+  hash = HashBytes(hash,&(*qwparam).marked,sizeof(int));
+  hash = HashBytes(hash,QWCOIN,strlen(QWCOIN));
+  hash = HashBytes(hash,&(*qwdata).stride,sizeof(int));
+  snprintf(name,size,"%s/%016llx.walk",options.cachedir,hash);
+}
+
+/**
+   ReadWalkFile reads a checkpoint of this walk from the file name, if
+   it has more than least steps. Returns the number of steps restored,
+   at most qwdata.steps * qwdata.stride, 0 if the file was not read, or -1 if it was
+   unreadable after state and qwdata.prob had been changed.
+*/
+int ReadWalkFile(char *name, GRAPH *graph, QWDATA *qwdata, QWPARAM *qwparam, double *state,
+		 int least)
+{
+  FILE *fptr;
+  CHECKPOINTHEADER header;
+  int n = (*graph).nodes, stride = (*qwdata).stride, i, t, saved, kept;
+
+  if ((fptr = fopen(name,"rb")) == NULL)
+    return(0);
+  BuildNeighbourLists(graph);
+  if (fread(&header,sizeof(CHECKPOINTHEADER),1,fptr) != 1 ||
+      strncmp(header.magic,QWCKPTMAGIC,8) != 0 || header.version != QWCKPTVERSION ||
+      header.nodes != n || header.arcs != (*graph).nbrstart[n] ||
+      header.hash != GraphHash(graph) || header.procedure != (*qwparam).procedure ||
+      header.start != (*qwparam).start || header.marked != (*qwparam).marked ||
+      header.stride != stride) {
+    fprintf(stderr,"ReadWalkFile: \"%s\" is not a record of this walk, ignoring it.\n",name);
+    fclose(fptr);
+    return(0);
+  }
+  if (header.steps <= least) {
+    fclose(fptr);
+    return(0);
+  }
+  t = (header.steps < (*qwdata).steps * stride) ? header.steps : (*qwdata).steps * stride;
+  /** The probabilities of the steps before header.steps, and before t */
+  saved = (header.steps + stride - 1) / stride;
+  kept = (t + stride - 1) / stride;
+  if (fread(state,sizeof(double),header.arcs,fptr) != header.arcs) {
+    fprintf(stderr,"ReadWalkFile: \"%s\" is truncated, starting from step 0.\n",name);
+    fclose(fptr);
+    return(-1);
+  }
+  for (i = 0; i < n; i++)
+    if (fread((*qwdata).prob[i],sizeof(double),kept,fptr) != kept ||
+	fseek(fptr,(long)(saved - kept) * sizeof(double),SEEK_CUR) != 0) {
+      fprintf(stderr,"ReadWalkFile: \"%s\" is truncated, starting from step 0.\n",name);
+      fclose(fptr);
+      return(-1);
+    }
+  fclose(fptr);
+  if (options.debug == TRUE)
+    fprintf(stderr,"ReadWalkFile: Read %d of %d steps from \"%s\".\n",t,header.steps,name);
+  return(t);
+}
+
+/**
+   WriteWalkFile saves the walk after t steps in the file name. Like
+   WriteLayoutCache, the file is written under a temporary name and
+   renamed, so a walk killed while writing leaves the last checkpoint
+   whole. Failing to write is only a warning.
+*/
+void WriteWalkFile(char *name, GRAPH *graph, QWDATA *qwdata, QWPARAM *qwparam, double *state,
+		   int t)
+{
+  FILE *fptr;
+  CHECKPOINTHEADER header;
+  char tmpname[600];
+  int n = (*graph).nodes, i, ok, kept = (t + (*qwdata).stride - 1) / (*qwdata).stride;
+
+  BuildNeighbourLists(graph);
+  snprintf(tmpname,600,"%s.%d",name,(int)getpid());
+  if ((fptr = fopen(tmpname,"wb")) == NULL) {
+    fprintf(stderr,"WriteWalkFile: Unable to open \"%s\"\n",tmpname);
+    return;
+  }
+  memset(&header,0,sizeof(CHECKPOINTHEADER));
+  memcpy(header.magic,QWCKPTMAGIC,8);
+  header.version = QWCKPTVERSION;
+  header.nodes = n;
+  header.hash = GraphHash(graph);
+  header.arcs = (*graph).nbrstart[n];
+  header.procedure = (*qwparam).procedure;
+  header.start = (*qwparam).start;
+  header.marked = (*qwparam).marked;
+  header.stride = (*qwdata).stride;
+  header.steps = t;
+  ok = (fwrite(&header,sizeof(CHECKPOINTHEADER),1,fptr) == 1 &&
+	fwrite(state,sizeof(double),header.arcs,fptr) == header.arcs);
+  for (i = 0; i < n && ok; i++)
+    ok = (fwrite((*qwdata).prob[i],sizeof(double),kept,fptr) == kept);
+  if (fclose(fptr) != 0)
+    ok = FALSE;
+  if (!ok || rename(tmpname,name) != 0) {
+    fprintf(stderr,"WriteWalkFile: Unable to write \"%s\"\n",name);
+    remove(tmpname);
+    return;
+  }
+  if (options.debug == TRUE)
+    fprintf(stderr,"WriteWalkFile: Saved step %d in \"%s\".\n",t,name);
+}
+
+/**
+   TrimWalkCache removes the cached walks (.walk files) in dir, least
+   recently used (oldest modification time) first, until they take no
+   more than limit bytes. The file keep, just written, is left.
+*/
+void TrimWalkCache(char *dir, double limit, char *keep)
+{
+  DIR *d;
+  struct dirent *entry;
+  struct stat info;
+  char path[512], oldest[512];
+  double total;
+  time_t when;
+  int len;
+
+  for (;;) {
+    if ((d = opendir(dir)) == NULL)
+      return;
+    total = 0.0;
+    oldest[0] = '\0';
+    when = 0;
+    while ((entry = readdir(d)) != NULL) {
+      len = strlen(entry->d_name);
+      if (len < 5 || strcmp(entry->d_name + len - 5,".walk") != 0)
+	continue;
+      snprintf(path,512,"%s/%s",dir,entry->d_name);
+      if (stat(path,&info) != 0)
+	continue;
+      total += info.st_size;
+      if (strcmp(path,keep) != 0 && (oldest[0] == '\0' || info.st_mtime < when)) {
+	strcpy(oldest,path);
+	when = info.st_mtime;
+      }
+    }
+    closedir(d);
+    if (total <= limit || oldest[0] == '\0')
+      return;
+    if (remove(oldest) != 0) {
+      fprintf(stderr,"TrimWalkCache: Unable to remove \"%s\"\n",oldest);
+      return;
+    }
+    if (options.debug == TRUE)
+      fprintf(stderr,"TrimWalkCache: Removed \"%s\" to keep the cache under %.0f MB.\n",
+	      oldest,limit / 1048576.0);
+  }
+}
+
+/** SpaceToArcs copies the amplitudes of the arcs out of the space matrix */
+void SpaceToArcs(MATDBL space, GRAPH *graph, double *state)
+{
+  int i, a;
+
+  BuildNeighbourLists(graph);
+  for (i = 0; i < (*graph).nodes; i++)
+    for (a = (*graph).nbrstart[i]; a < (*graph).nbrstart[i+1]; a++)
+      state[a] = space[i][(*graph).nbr[a]];
+}
+
+/** ArcsToSpace copies the amplitudes of the arcs into the space matrix */
+void ArcsToSpace(double *state, GRAPH *graph, MATDBL *space)
+{
+  int i, a;
+
+  BuildNeighbourLists(graph);
+  for (i = 0; i < (*graph).nodes; i++)
+    for (a = (*graph).nbrstart[i]; a < (*graph).nbrstart[i+1]; a++)
+      (*space)[i][(*graph).nbr[a]] = state[a];
+}
+
+/**
+   MallocCheckpointState makes room for the amplitudes of the arcs if
+   the walk is checkpointed, resumed or cached, and otherwise returns
+   NULL.
+*/
+double *MallocCheckpointState(GRAPH *graph, QWPARAM *qwparam)
+{
+  double *state;
+  int arcs;
+
+  if ((*qwparam).checkpoint <= 0 && (*qwparam).resume == FALSE && !WalkCacheOn())
+    return(NULL);
+  BuildNeighbourLists(graph);
+  arcs = (*graph).nbrstart[(*graph).nodes];
+  if ((state = malloc((arcs > 0 ? arcs : 1) * sizeof(double))) == NULL) {
+    fprintf(stderr,"MallocCheckpointState: Memory allocation failed.\n");
+    exit(-1);
+  }
+  return(state);
+}
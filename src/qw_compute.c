@@ -42,6 +42,48 @@ void DegreeVec(VECINT *d, GRAPH *graph) {
   }
 }
 
+/**
+   BuildNeighbourLists stores the neighbours of every vertex in order,
+   so that sparse graphs can be traversed without scanning the rows of
+   the adjacency matrix. Each entry a of nbr is also an arc i -> j of 
+   the walk, and reverse[a] is the arc j -> i (or -1 if the adjacency 
+   matrix is not symmetric). Does nothing if the lists exist.
+*/
+void BuildNeighbourLists(GRAPH *graph) {
+  int i = 0;
+  int j = 0;
+  int arcs = 0;
+  int a, lo, hi, mid;
+
+  if ((*graph).nbr != NULL)
+    return;
+  for (i = 0; i < (*graph).nodes; i++)
+    for (j = 0; j < (*graph).nodes; j++)
+      if ((*graph).adj[i][j] == 1) arcs++;
+  MallocNeighbourLists(graph,arcs);
+  arcs = 0;
+  for (i = 0; i < (*graph).nodes; i++) {
+    (*graph).nbrstart[i] = arcs;
+    for (j = 0; j < (*graph).nodes; j++)
+      if ((*graph).adj[i][j] == 1) (*graph).nbr[arcs++] = j;
+  }
+  (*graph).nbrstart[(*graph).nodes] = arcs;
+
+  /** The lists are sorted, so the arc back is found by bisection */
+  for (i = 0; i < (*graph).nodes; i++)
+    for (a = (*graph).nbrstart[i]; a < (*graph).nbrstart[i+1]; a++) {
+      j = (*graph).nbr[a];
+      lo = (*graph).nbrstart[j];
+      hi = (*graph).nbrstart[j+1];
+      while (hi - lo > 1 && (*graph).nbr[lo] != i) {
+	mid = (lo + hi) / 2;
+	if ((*graph).nbr[mid] <= i) lo = mid;
+	else hi = mid;
+      }
+      (*graph).reverse[a] = (lo < hi && (*graph).nbr[lo] == i) ? lo : -1;
+    }
+}
+
 /** 
    Normalisation returns the sum of the probabilities for each state. 
 */
@@ -55,6 +97,48 @@ double Normalisation(MATDBL x, int n) {
   return sum;
 }
 
+void InitialiseNormDrift(NORMDRIFT *drift) {
+  (*drift).checks = 0;
+  (*drift).largest = 0.0;
+  (*drift).largeststep = 0;
+  (*drift).last = 0.0;
+  (*drift).renormalised = 0;
+}
+
+/**
+   CheckNorm records the norm of the state at step t, as summed with
+   the probabilities. Returns TRUE if it is more than QWNORMTOLERANCE
+   from 1.
+*/
+int CheckNorm(NORMDRIFT *drift, double norm, int t) {
+  (*drift).checks += 1;
+  (*drift).last = norm - 1.0;
+  if (fabs(norm - 1.0) > (*drift).largest) {
+    (*drift).largest = fabs(norm - 1.0);
+    (*drift).largeststep = t;
+  }
+  return(fabs(norm - 1.0) > QWNORMTOLERANCE);
+}
+
+/** ScaleAmplitudes multiplies the count amplitudes in amp by factor */
+void ScaleAmplitudes(double *amp, int count, double factor) {
+  int a;
+
+  for (a = 0; a < count; a++)
+    amp[a] *= factor;
+}
+
+/** ReportNormDrift prints the drift of the norm over the walk */
+void ReportNormDrift(NORMDRIFT *drift, char *engine) {
+  if ((*drift).checks == 0)
+    return;
+  fprintf(stderr,"%s: Norm drift %.2e at most (step %d), %.2e at the end, %d checks",
+	  engine,(*drift).largest,(*drift).largeststep,(*drift).last,(*drift).checks);
+  if ((*drift).renormalised > 0)
+    fprintf(stderr,", renormalised %d times",(*drift).renormalised);
+  fprintf(stderr,".\n");
+}
+
 /** 
    InitialiseSingleVertex initialises the space to have a single particle
    located at qwparam.start vertex in an equal (real) superposition of all
@@ -141,27 +225,17 @@ void NegativeIdentity(MATDBL *coin, int d) {
 /** 
    CoinOperation performs the unitary application of a grover coin 
    operator to each of the vertex states in the graph. If vertex = 
-   qwparam.marked then the -I coin is used. 
+   qwparam.marked then the -I coin is used. The amplitudes and the
+   coin of each vertex are held in the workspace.
 */
-void CoinOperation(MATDBL *space, GRAPH *graph, QWPARAM *qwparam) {
-  VECINT d;
-  MATDBL coin;
-  VECDBL v, vNew;
+void CoinOperation(MATDBL *space, GRAPH *graph, QWPARAM *qwparam, QWWORKSPACE *work) {
+  VECINT d = (*work).degree;
+  MATDBL coin = (*work).coin;
+  VECDBL v = (*work).v, vNew = (*work).vNew;
   int i, j, k, l;
   int take, replace;
 
-  /** allocate and fill degree vector */
-  MallocVecInt(&d,(*graph).nodes);
-  DegreeVec(&d,graph);
-
   for (i = 0; i < (*graph).nodes; i++) {
-    /** allocate vectors to hold the probability amplitudes. */
-    MallocVecDbl(&v, d[i]);
-    MallocVecDbl(&vNew, d[i]);
-    /** allocate a matrix for the coin depending on the degree. */
-    MallocMatDbl(&coin, d[i], d[i]);
-    Grover(&coin,d[i]);
-
     /** collect non-zero prob amplitudes into a vector. */
     take = 0;
     for (j = 0; j < (*graph).nodes; j++) 
@@ -192,26 +266,19 @@ void CoinOperation(MATDBL *space, GRAPH *graph, QWPARAM *qwparam) {
 	(*space)[i][j] = vNew[replace];
 	replace += 1;
       }
-    /** Free the probability amplitude vectors and the coin matrix. */ 
-    FreeMatDbl(&coin, d[i]);
-    FreeVecDbl(&vNew);
-    FreeVecDbl(&v);
   }
-  FreeVecInt(&d);
 }
 
 /** 
    TranslationOperation performs the unitary shift or translation 
    operation of shifting probability amplitudes between connected 
-   subnodes.
+   subnodes. The old amplitudes are copied to the workspace.
 */
-void TranslationOperation(MATDBL *space, GRAPH *graph) {
+void TranslationOperation(MATDBL *space, GRAPH *graph, QWWORKSPACE *work) {
   int i, j;
-  MATDBL spaceOld;
+  MATDBL spaceOld = (*work).spaceOld;
 
-  /** Allocate a space matrix to hold the incoming probability 
-     amplitudes. */
-  MallocMatDbl(&spaceOld,(*graph).nodes,(*graph).nodes);
+  /** Copy the space to hold the incoming probability amplitudes. */
   for (i = 0; i < (*graph).nodes; i++)
     for (j = 0; j < (*graph).nodes; j++) {
       spaceOld[i][j] = (*space)[i][j];
@@ -221,61 +288,83 @@ void TranslationOperation(MATDBL *space, GRAPH *graph) {
     for (j = 0; j < (*graph).nodes; j++) {
       if ((*graph).adj[i][j] == 1) (*space)[i][j] = spaceOld[j][i];
     }
-  /** Free the space matrix. */
-  FreeMatDbl(&spaceOld,(*graph).nodes);
 }
 
 /** 
    QuantumSearch performs a quantum-walk-based Grover search for 
-   a single marked vertex on a graph. qwdata.prob is allocated here 
+   a single marked vertex on a graph. The probabilities are stored
+   every qwdata.stride steps. Each step is one FusedStep over the
+   arcs (qw_fused.c), which also sums the norm for CheckNorm.
+   qwdata.prob is allocated here 
    but not freed. 
 */
 void QuantumSearch(GRAPH *graph, QWDATA *qwdata, QWPARAM *qwparam) {
-  int i = 0;
-  int j = 0;
   int t = 0;
-  MATDBL space = NULL;
+  double *amp, *next, *swap, norm;
+  NORMDRIFT drift;
   
-  MallocMatDbl(&space,(*graph).nodes,(*graph).nodes);
   MallocQWprob(qwdata,graph);
-  InitialiseEqualSuperposition(&space,graph);
-  for (t = 0; t < (*qwdata).steps; t++) {
-    for (i = 0; i < (*graph).nodes; i++) {
-      (*qwdata).prob[i][t] = 0.0;
-      for (j = 0; j < (*graph).nodes; j++)
-	(*qwdata).prob[i][t] += pow(space[i][j],2);
+  amp = MallocArcAmplitudes(graph);
+  next = MallocArcAmplitudes(graph);
+  InitialiseNormDrift(&drift);
+  /** carry on from a checkpoint? */
+  if ((t = ReadCheckpoint(graph,qwdata,qwparam,amp)) == 0)
+    ArcEqualSuperposition(graph,amp);
+  for (; t < (*qwdata).steps * (*qwdata).stride; t++) {
+    norm = FusedStep(graph,(*qwparam).marked,amp,next,
+		     (t % (*qwdata).stride == 0) ? (*qwdata).prob : NULL,t/(*qwdata).stride);
+    swap = amp;
+    amp = next;
+    next = swap;
+    /** the step is unitary, so the new state has the same norm */
+    if (CheckNorm(&drift,norm,t) && (*qwparam).renormalise == TRUE) {
+      ScaleAmplitudes(amp,(*graph).nbrstart[(*graph).nodes],1.0/sqrt(norm));
+      drift.renormalised += 1;
     }
-    CoinOperation(&space,graph,qwparam);
-    TranslationOperation(&space,graph);
+    if (CheckpointDue(qwdata,qwparam,t+1))
+      WriteCheckpoint(graph,qwdata,qwparam,amp,t+1);
   }
-  FreeMatDbl(&space,(*graph).nodes);
+  ReportNormDrift(&drift,"QuantumSearch");
+  free(amp);
+  free(next);
 }
 
 /** 
    QuantumWalk performs a quantum walk starting from a single vertex 
-   with a Grover coin operator. qwdata.prob is allocated here 
+   with a Grover coin operator, storing the probabilities every
+   qwdata.stride steps. Each step is one FusedStep over the arcs
+   with no marked vertex. qwdata.prob is allocated here 
    but not freed. 
 */
 void QuantumWalk(GRAPH *graph, QWDATA *qwdata, QWPARAM *qwparam) {
-  int i, j, t;
-  MATDBL space = NULL;
+  int t = 0;
+  double *amp, *next, *swap, norm;
+  NORMDRIFT drift;
   
-  MallocMatDbl(&space,(*graph).nodes,(*graph).nodes);
   MallocQWprob(qwdata,graph);
-  InitialiseSingleVertex(&space,graph,qwparam);
-  for (t = 0; t < (*qwdata).steps; t++) {
-    for (i = 0; i < (*graph).nodes; i++) {
-      (*qwdata).prob[i][t] = 0.0;
-      for (j = 0; j < (*graph).nodes; j++)
-	(*qwdata).prob[i][t] += pow(space[i][j],2);
+  amp = MallocArcAmplitudes(graph);
+  next = MallocArcAmplitudes(graph);
+  InitialiseNormDrift(&drift);
+  /** carry on from a checkpoint? */
+  if ((t = ReadCheckpoint(graph,qwdata,qwparam,amp)) == 0)
+    ArcSingleVertex(graph,(*qwparam).start,amp);
+  for (; t < (*qwdata).steps * (*qwdata).stride; t++) {
+    norm = FusedStep(graph,-1,amp,next,
+		     (t % (*qwdata).stride == 0) ? (*qwdata).prob : NULL,t/(*qwdata).stride);
+    swap = amp;
+    amp = next;
+    next = swap;
+    /** the step is unitary, so the new state has the same norm */
+    if (CheckNorm(&drift,norm,t) && (*qwparam).renormalise == TRUE) {
+      ScaleAmplitudes(amp,(*graph).nbrstart[(*graph).nodes],1.0/sqrt(norm));
+      drift.renormalised += 1;
     }
-    /** note final argument to coinOperation is the marked vertex
-       but vertex n does not exist so when qwparam.marked = 
-       graph.nodes, all vertices use the grover coin. */
-    CoinOperation(&space,graph,qwparam); 
-    TranslationOperation(&space,graph);
+    if (CheckpointDue(qwdata,qwparam,t+1))
+      WriteCheckpoint(graph,qwdata,qwparam,amp,t+1);
   }
-  FreeMatDbl(&space,(*graph).nodes);
+  ReportNormDrift(&drift,"QuantumWalk");
+  free(amp);
+  free(next);
 }
 
 /** 
@@ -288,10 +377,24 @@ int ComputeProbabilities(GRAPH *graph, QWDATA *qwdata, QWPARAM *qwparam, QWFILE
   int err = 0;
   /** Read adjacency and call quantum walk routines */
   ReadAdjacency(qwfile, graph);
+  if ((*qwparam).reorder == TRUE)
+    ReorderGraph(graph,qwparam);
+  if ((*qwparam).sweep != NULL) {
+    SearchSweep(graph,qwdata,qwparam);
+    RestoreGraphOrder(graph,qwdata,qwparam);
+    return(0);
+  }
+  if ((*qwparam).startsweep != NULL) {
+    StartSweep(graph,qwdata,qwparam,qwfile);
+    RestoreGraphOrder(graph,qwdata,qwparam);
+    return(0);
+  }
   if ((*qwparam).procedure == 'w') {
     if ((*qwparam).start >= (*graph).nodes || (*qwparam).start < 0) {
       fprintf(stderr,"ComputeProbabilities error: vertex %d does not exist.\n",(*qwparam).start+1);
       exit(-1);
+    } else if ((*qwparam).symmetry == TRUE) {
+      QuotientWalk(graph,qwdata,qwparam);
     } else {
       QuantumWalk(graph,qwdata,qwparam);
     } 
@@ -299,10 +402,13 @@ int ComputeProbabilities(GRAPH *graph, QWDATA *qwdata, QWPARAM *qwparam, QWFILE
     if ((*qwparam).marked >= (*graph).nodes || (*qwparam).start < 0) {
       fprintf(stderr,"ComputeProbabilities error: vertex %d does not exist.\n",(*qwparam).marked+1);
       exit(-1);
+    } else if ((*qwparam).symmetry == TRUE) {
+      QuotientWalk(graph,qwdata,qwparam);
     } else {   
       QuantumSearch(graph,qwdata,qwparam);
     }
   }
+  RestoreGraphOrder(graph,qwdata,qwparam);
   /** write data to a file? */
   if ((*qwparam).write == TRUE) {
     if ((*qwfile).outtype == 'r')
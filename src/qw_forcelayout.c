@@ -0,0 +1,495 @@
+/*=======================================================================
+   qwViz - OpenGL visualisation of quantum walks on graphs
+  -----------------------------------------------------------------------
+    Copyright (C) 2011 Scott D. Berry
+    Contact: scottdberry 'at' gmail
+
+    This file is part of qwViz.
+
+    qwViz is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qwViz is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qwViz.  If not, see <http://www.gnu.org/licenses/>.
+  ========================================================================*/
+#include "qwViz.h"
+
+/** 
+   qw_forcelayout.c is a native multilevel force-directed layout, 
+   selected with -multilevel, for graphs too large for the GraphViz 
+   engines. It works on the neighbour lists rather than the adjacency 
+   matrix. The graph is coarsened by repeatedly merging matched pairs 
+   of neighbours, the coarsest graph is laid out from random positions,
+   and each finer level starts from the layout of the one above. 
+   Forces are spring attraction along edges and a repulsion between 
+   vertices that is cut off at a few edge lengths, so a grid of that 
+   size finds all the pairs that interact in linear time. The forces 
+   on each vertex are computed in parallel.
+   ====================================================================
+*/
+
+extern OPTIONS options;
+
+/**
+   MultilevelLayout positions the vertices of graph in Xcoord and 
+   Ycoord, with edges of about unit length.
+*/
+void MultilevelLayout(GRAPH *graph)
+{
+  LAYOUTLEVEL levels[FORCELEVELS];
+  int i, l, nlevels;
+  unsigned int seed = 1;
+  double k;
+
+  nlevels = BuildLayoutLevels(graph,levels,&seed);
+
+  /** The natural length grows on coarser levels, whose vertices are 
+      clusters, by sqrt(7/4) per level as suggested by Hu (2005) */
+  l = nlevels - 1;
+  k = pow(sqrt(7.0/4.0),l);
+  for (i = 0; i < levels[l].n; i++) {
+    levels[l].x[i] = k * sqrt(levels[l].n) * LayoutRandom(&seed);
+    levels[l].y[i] = k * sqrt(levels[l].n) * LayoutRandom(&seed);
+  }
+  ForceDirected(&levels[l],k,FORCECOARSEITER,k);
+  PublishLayoutLevel(levels,l,levels[l].x,levels[l].y);
+  for (l = nlevels - 2; l >= 0; l--) {
+    k = pow(sqrt(7.0/4.0),l);
+    for (i = 0; i < levels[l].n; i++) {
+      levels[l].x[i] = levels[l+1].x[levels[l].coarse[i]] + 0.1 * k * (LayoutRandom(&seed) - 0.5);
+      levels[l].y[i] = levels[l+1].y[levels[l].coarse[i]] + 0.1 * k * (LayoutRandom(&seed) - 0.5);
+    }
+    ForceDirected(&levels[l],k,FORCEFINEITER,0.2*k);
+    PublishLayoutLevel(levels,l,levels[l].x,levels[l].y);
+    FreeLayoutLevel(&levels[l+1]);
+  }
+  free(levels[0].mass);
+  free(levels[0].coarse);
+}
+
+/**
+   BuildLayoutLevels fills levels[0] with the graph itself, coordinates
+   in Xcoord and Ycoord, and coarsens it until it is small or stops 
+   shrinking. Returns the number of levels; the caller frees levels[0]
+   mass and coarse, and FreeLayoutLevel's the others.
+*/
+int BuildLayoutLevels(GRAPH *graph, LAYOUTLEVEL *levels, unsigned int *seed)
+{
+  int i, nlevels = 1;
+
+  BuildNeighbourLists(graph);
+  levels[0].n = (*graph).nodes;
+  levels[0].nbrstart = (*graph).nbrstart;
+  levels[0].nbr = (*graph).nbr;
+  levels[0].mass = malloc(levels[0].n * sizeof(double));
+  levels[0].coarse = malloc(levels[0].n * sizeof(int));
+  levels[0].x = (*graph).Xcoord;
+  levels[0].y = (*graph).Ycoord;
+  if (levels[0].mass == NULL || levels[0].coarse == NULL) {
+    fprintf(stderr,"BuildLayoutLevels: Memory allocation failed.\n");
+    exit(-1);
+  }
+  for (i = 0; i < levels[0].n; i++)
+    levels[0].mass[i] = 1.0;
+
+  /** Coarsen until small, or until matching stops shrinking the graph */
+  while (nlevels < FORCELEVELS && levels[nlevels-1].n > FORCECOARSEST
+	 && CoarsenLevel(&levels[nlevels-1],&levels[nlevels],seed) == 0)
+    nlevels++;
+  if (options.debug == TRUE)
+    fprintf(stderr,"BuildLayoutLevels: %d levels, coarsest has %d vertices.\n",
+	    nlevels,levels[nlevels-1].n);
+  return(nlevels);
+}
+
+/**
+   CoarsenLevel merges each vertex of fine with an unmatched neighbour,
+   the lightest one, visiting the vertices in random order. Unmatched 
+   vertices are carried over alone. Fills in coarse and fine.coarse, 
+   and returns -1 (with nothing allocated) if the graph would not shrink
+   by at least a quarter.
+*/
+int CoarsenLevel(LAYOUTLEVEL *fine, LAYOUTLEVEL *coarse, unsigned int *seed)
+{
+  int i, j, k, a, b, n = (*fine).n, nc = 0, arcs = 0, best, swap;
+  int *order, *marker, *members, *memberstart;
+
+  order = malloc(n * sizeof(int));
+  marker = malloc(n * sizeof(int));
+  if (order == NULL || marker == NULL) {
+    fprintf(stderr,"CoarsenLevel: Memory allocation failed.\n");
+    exit(-1);
+  }
+  for (i = 0; i < n; i++) {
+    order[i] = i;
+    (*fine).coarse[i] = -1;
+  }
+  for (i = n - 1; i > 0; i--) {
+    j = (int)(LayoutRandom(seed) * (i + 1));
+    if (j > i) j = i;
+    swap = order[i]; order[i] = order[j]; order[j] = swap;
+  }
+  for (k = 0; k < n; k++) {
+    i = order[k];
+    if ((*fine).coarse[i] >= 0)
+      continue;
+    best = -1;
+    for (a = (*fine).nbrstart[i]; a < (*fine).nbrstart[i+1]; a++) {
+      j = (*fine).nbr[a];
+      if (j != i && (*fine).coarse[j] < 0 &&
+	  (best < 0 || (*fine).mass[j] < (*fine).mass[best]))
+	best = j;
+    }
+    (*fine).coarse[i] = nc;
+    if (best >= 0)
+      (*fine).coarse[best] = nc;
+    nc++;
+  }
+  if (nc > 0.75 * n) {
+    free(order);
+    free(marker);
+    return(-1);
+  }
+
+  /** Group the fine vertices by cluster, then merge their neighbours */
+  memberstart = calloc(nc + 1, sizeof(int));
+  members = malloc(n * sizeof(int));
+  (*coarse).n = nc;
+  (*coarse).nbrstart = malloc((nc + 1) * sizeof(int));
+  (*coarse).mass = calloc(nc, sizeof(double));
+  (*coarse).coarse = malloc(nc * sizeof(int));
+  (*coarse).x = malloc(nc * sizeof(double));
+  (*coarse).y = malloc(nc * sizeof(double));
+  (*coarse).nbr = malloc(((*fine).nbrstart[n] > 0 ? (*fine).nbrstart[n] : 1) * sizeof(int));
+  if (memberstart == NULL || members == NULL || (*coarse).nbrstart == NULL ||
+      (*coarse).mass == NULL || (*coarse).coarse == NULL || (*coarse).x == NULL ||
+      (*coarse).y == NULL || (*coarse).nbr == NULL) {
+    fprintf(stderr,"CoarsenLevel: Memory allocation failed.\n");
+    exit(-1);
+  }
+  for (i = 0; i < n; i++) {
+    memberstart[(*fine).coarse[i] + 1]++;
+    (*coarse).mass[(*fine).coarse[i]] += (*fine).mass[i];
+  }
+  for (i = 0; i < nc; i++)
+    memberstart[i+1] += memberstart[i];
+  for (i = 0; i < n; i++)
+    members[memberstart[(*fine).coarse[i]]++] = i;
+  for (i = nc; i > 0; i--)
+    memberstart[i] = memberstart[i-1];
+  memberstart[0] = 0;
+
+  for (i = 0; i < n; i++)
+    marker[i] = -1;
+  for (i = 0; i < nc; i++) {
+    (*coarse).nbrstart[i] = arcs;
+    for (k = memberstart[i]; k < memberstart[i+1]; k++) {
+      a = members[k];
+      for (b = (*fine).nbrstart[a]; b < (*fine).nbrstart[a+1]; b++) {
+	j = (*fine).coarse[(*fine).nbr[b]];
+	if (j != i && marker[j] != i) {
+	  marker[j] = i;
+	  (*coarse).nbr[arcs++] = j;
+	}
+      }
+    }
+  }
+  (*coarse).nbrstart[nc] = arcs;
+
+  free(order);
+  free(marker);
+  free(members);
+  free(memberstart);
+  return(0);
+}
+
+/**
+   ForceDirected moves the vertices of level for at most maxiter 
+   iterations, with natural edge length k and a first step of step. 
+   The step adapts as in Hu (2005): it grows after five iterations in 
+   a row that lower the energy and shrinks otherwise, and the layout 
+   has converged once it is below a hundredth of k.
+*/
+void ForceDirected(LAYOUTLEVEL *level, double k, int maxiter, double step)
+{
+  FORCEPASS pass;
+  int i, iter, progress = 0;
+  double energy, lastenergy = -1, f;
+
+  if ((*level).n < 2)
+    return;
+  pass.level = level;
+  pass.k = k;
+  pass.cutoff = 3.0 * k;
+  pass.fx = malloc((*level).n * sizeof(double));
+  pass.fy = malloc((*level).n * sizeof(double));
+  pass.cellvertex = malloc((*level).n * sizeof(int));
+  pass.cellstart = NULL;
+  if (pass.fx == NULL || pass.fy == NULL || pass.cellvertex == NULL) {
+    fprintf(stderr,"ForceDirected: Memory allocation failed.\n");
+    exit(-1);
+  }
+
+  for (iter = 0; iter < maxiter && step > 0.01 * k; iter++) {
+    BuildForceGrid(&pass);
+    ParallelFor((*level).n,ComputeForces,&pass);
+    energy = 0;
+    for (i = 0; i < (*level).n; i++) {
+      f = sqrt(pass.fx[i]*pass.fx[i] + pass.fy[i]*pass.fy[i]);
+      energy += f*f;
+      if (f > 0) {
+	(*level).x[i] += step * pass.fx[i] / f;
+	(*level).y[i] += step * pass.fy[i] / f;
+      }
+    }
+    if (lastenergy < 0 || energy < lastenergy) {
+      if (++progress >= 5) {
+	progress = 0;
+	step /= 0.9;
+      }
+    } else {
+      progress = 0;
+      step *= 0.9;
+    }
+    lastenergy = energy;
+  }
+  if (options.debug == TRUE)
+    fprintf(stderr,"ForceDirected: %d vertices, %d iterations.\n",(*level).n,iter);
+
+  free(pass.fx);
+  free(pass.fy);
+  free(pass.cellvertex);
+  free(pass.cellstart);
+}
+
+/**
+   BuildForceGrid sorts the vertices into square cells at least the 
+   repulsion cutoff wide, so that every vertex within the cutoff of 
+   another is in its own or an adjacent cell.
+*/
+void BuildForceGrid(FORCEPASS *pass)
+{
+  LAYOUTLEVEL *level = (*pass).level;
+  int i, c, cx, cy, ncells;
+  double xmax, ymax;
+
+  (*pass).xmin = xmax = (*level).x[0];
+  (*pass).ymin = ymax = (*level).y[0];
+  for (i = 1; i < (*level).n; i++) {
+    if ((*level).x[i] < (*pass).xmin) (*pass).xmin = (*level).x[i];
+    if ((*level).x[i] > xmax) xmax = (*level).x[i];
+    if ((*level).y[i] < (*pass).ymin) (*pass).ymin = (*level).y[i];
+    if ((*level).y[i] > ymax) ymax = (*level).y[i];
+  }
+  (*pass).cellsize = (*pass).cutoff;
+  if ((xmax - (*pass).xmin) / FORCEGRIDMAX > (*pass).cellsize)
+    (*pass).cellsize = (xmax - (*pass).xmin) / FORCEGRIDMAX;
+  if ((ymax - (*pass).ymin) / FORCEGRIDMAX > (*pass).cellsize)
+    (*pass).cellsize = (ymax - (*pass).ymin) / FORCEGRIDMAX;
+  (*pass).gridx = (int)((xmax - (*pass).xmin) / (*pass).cellsize) + 1;
+  (*pass).gridy = (int)((ymax - (*pass).ymin) / (*pass).cellsize) + 1;
+  ncells = (*pass).gridx * (*pass).gridy;
+
+  free((*pass).cellstart);
+  if (((*pass).cellstart = calloc(ncells + 1, sizeof(int))) == NULL) {
+    fprintf(stderr,"BuildForceGrid: Memory allocation failed.\n");
+    exit(-1);
+  }
+  for (i = 0; i < (*level).n; i++) {
+    cx = (int)(((*level).x[i] - (*pass).xmin) / (*pass).cellsize);
+    cy = (int)(((*level).y[i] - (*pass).ymin) / (*pass).cellsize);
+    (*pass).cellstart[cy * (*pass).gridx + cx + 1]++;
+  }
+  for (c = 0; c < ncells; c++)
+    (*pass).cellstart[c+1] += (*pass).cellstart[c];
+  for (i = 0; i < (*level).n; i++) {
+    cx = (int)(((*level).x[i] - (*pass).xmin) / (*pass).cellsize);
+    cy = (int)(((*level).y[i] - (*pass).ymin) / (*pass).cellsize);
+    (*pass).cellvertex[(*pass).cellstart[cy * (*pass).gridx + cx]++] = i;
+  }
+  for (c = ncells; c > 0; c--)
+    (*pass).cellstart[c] = (*pass).cellstart[c-1];
+  (*pass).cellstart[0] = 0;
+}
+
+/**
+   ComputeForces finds the force on vertices start to end-1, called 
+   from ParallelFor. Edges pull with d^2/k, and every vertex within the
+   cutoff pushes with mass k^2/d.
+*/
+void ComputeForces(int start, int end, void *arg)
+{
+  FORCEPASS *pass = arg;
+  LAYOUTLEVEL *level = (*pass).level;
+  int i, j, a, c, cx, cy, gx, gy;
+  double dx, dy, d2, k2, cutoff2, fx, fy;
+
+  k2 = (*pass).k * (*pass).k;
+  cutoff2 = (*pass).cutoff * (*pass).cutoff;
+  for (i = start; i < end; i++) {
+    fx = 0;
+    fy = 0;
+    cx = (int)(((*level).x[i] - (*pass).xmin) / (*pass).cellsize);
+    cy = (int)(((*level).y[i] - (*pass).ymin) / (*pass).cellsize);
+    for (gy = cy - 1; gy <= cy + 1; gy++) {
+      if (gy < 0 || gy >= (*pass).gridy)
+	continue;
+      for (gx = cx - 1; gx <= cx + 1; gx++) {
+	if (gx < 0 || gx >= (*pass).gridx)
+	  continue;
+	c = gy * (*pass).gridx + gx;
+	for (a = (*pass).cellstart[c]; a < (*pass).cellstart[c+1]; a++) {
+	  j = (*pass).cellvertex[a];
+	  dx = (*level).x[i] - (*level).x[j];
+	  dy = (*level).y[i] - (*level).y[j];
+	  d2 = dx*dx + dy*dy;
+	  if (j != i && d2 < cutoff2 && d2 > 0) {
+	    fx += k2 * (*level).mass[j] * dx / d2;
+	    fy += k2 * (*level).mass[j] * dy / d2;
+	  }
+	}
+      }
+    }
+    for (a = (*level).nbrstart[i]; a < (*level).nbrstart[i+1]; a++) {
+      j = (*level).nbr[a];
+      dx = (*level).x[i] - (*level).x[j];
+      dy = (*level).y[i] - (*level).y[j];
+      d2 = sqrt(dx*dx + dy*dy);
+      fx -= d2 * dx / (*pass).k;
+      fy -= d2 * dy / (*pass).k;
+    }
+    (*pass).fx[i] = fx;
+    (*pass).fy[i] = fy;
+  }
+}
+
+void FreeLayoutLevel(LAYOUTLEVEL *level)
+{
+  free((*level).nbrstart);
+  free((*level).nbr);
+  free((*level).mass);
+  free((*level).coarse);
+  free((*level).x);
+  free((*level).y);
+}
+
+/**
+   LayoutRandom returns a uniform random number in [0,1), from its own
+   generator so that layouts are repeatable.
+*/
+double LayoutRandom(unsigned int *seed)
+{
+  *seed = *seed * 1103515245 + 12345;
+  return(((*seed >> 8) & 0xffffff) / 16777216.0);
+}
+
+/**
+   LayoutStress measures how well the drawn distances match the graph
+   distances d_ij, as sum (s |x_i - x_j| - d_ij)^2 / d_ij^2 over the 
+   pairs, with the scale s that minimises it, divided by the number of
+   pairs. Large graphs are measured from a sample of 200 sources.
+   edgecv is set to the standard deviation over the mean of the edge 
+   lengths.
+*/
+double LayoutStress(GRAPH *graph, double *edgecv)
+{
+  int n = (*graph).nodes, i, j, a, s, head, tail, nsources, pairs = 0;
+  int *dist, *queue;
+  double num = 0, den = 0, d, e, esum = 0, esum2 = 0, scale;
+  long edges = 0;
+
+  BuildNeighbourLists(graph);
+  dist = malloc(n * sizeof(int));
+  queue = malloc(n * sizeof(int));
+  if (dist == NULL || queue == NULL) {
+    fprintf(stderr,"LayoutStress: Memory allocation failed.\n");
+    exit(-1);
+  }
+  for (i = 0; i < n; i++)
+    for (a = (*graph).nbrstart[i]; a < (*graph).nbrstart[i+1]; a++) {
+      j = (*graph).nbr[a];
+      e = sqrt(pow((*graph).Xcoord[i] - (*graph).Xcoord[j],2) +
+	       pow((*graph).Ycoord[i] - (*graph).Ycoord[j],2));
+      esum += e;
+      esum2 += e*e;
+      edges++;
+    }
+  *edgecv = 0;
+  if (edges > 0 && esum > 0)
+    *edgecv = sqrt(fabs(esum2/edges - pow(esum/edges,2))) / (esum/edges);
+
+  /** The best scale and the stress are both sums over the same pairs,
+      so the sums needed for each are gathered in one sweep */
+  nsources = (n > 200) ? 200 : n;
+  for (s = 0; s < nsources; s++) {
+    i = (int)((long)s * n / nsources);
+    for (j = 0; j < n; j++)
+      dist[j] = -1;
+    dist[i] = 0;
+    queue[0] = i;
+    head = 0;
+    tail = 1;
+    while (head < tail) {
+      a = queue[head++];
+      for (j = (*graph).nbrstart[a]; j < (*graph).nbrstart[a+1]; j++)
+	if (dist[(*graph).nbr[j]] < 0) {
+	  dist[(*graph).nbr[j]] = dist[a] + 1;
+	  queue[tail++] = (*graph).nbr[j];
+	}
+    }
+    for (j = 0; j < n; j++) {
+      if (j == i || dist[j] <= 0)
+	continue;
+      d = sqrt(pow((*graph).Xcoord[i] - (*graph).Xcoord[j],2) +
+	       pow((*graph).Ycoord[i] - (*graph).Ycoord[j],2));
+      num += d / dist[j];
+      den += d * d / ((double)dist[j] * dist[j]);
+      pairs++;
+    }
+  }
+  free(dist);
+  free(queue);
+  if (pairs == 0 || den <= 0)
+    return(0);
+
+  /** With w = 1/d_ij^2, stress(s) = s^2 den - 2 s num + pairs */
+  scale = num / den;
+  return((scale*scale*den - 2*scale*num + pairs) / pairs);
+}
+
+/**
+   BenchmarkLayout lays out graph with neato, fdp, -multilevel and 
+   -spectral and prints the time and quality of each: stress (0 when 
+   the drawing distances are proportional to graph distances) and the 
+   spread of the edge lengths.
+*/
+void BenchmarkLayout(GRAPH *graph)
+{
+  char *algorithms[4] = {"neato","fdp","multilevel","spectral"};
+  char saved[64];
+  int i;
+  double tstart, seconds, stress, edgecv;
+
+  strcpy(saved,(*graph).layoutalgorithm);
+  BuildNeighbourLists(graph);
+  fprintf(stderr,"BenchmarkLayout: %d vertices, %d edges, %d threads\n",
+	  (*graph).nodes,(*graph).nbrstart[(*graph).nodes]/2,GetParallelThreads());
+  fprintf(stderr,"%12s %10s %10s %10s\n","algorithm","seconds","stress","edge cv");
+  for (i = 0; i < 4; i++) {
+    strcpy((*graph).layoutalgorithm,algorithms[i]);
+    tstart = GetRunTime();
+    LayoutGraph(graph);
+    seconds = GetRunTime() - tstart;
+    stress = LayoutStress(graph,&edgecv);
+    fprintf(stderr,"%12s %10.3f %10.4f %10.4f\n",algorithms[i],seconds,stress,edgecv);
+    FreeCoordinateLists(graph);
+  }
+  strcpy((*graph).layoutalgorithm,saved);
+}
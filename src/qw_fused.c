@@ -0,0 +1,267 @@
+/*=======================================================================
+   qwViz - OpenGL visualisation of quantum walks on graphs
+  -----------------------------------------------------------------------
+    Copyright (C) 2011 Scott D. Berry
+    Contact: scottdberry 'at' gmail
+
+    This file is part of qwViz.
+
+    qwViz is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qwViz is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qwViz.  If not, see <http://www.gnu.org/licenses/>.
+  ========================================================================*/
+#include "qwViz.h"
+
+/**
+   qw_fused.c is the step of QuantumWalk and QuantumSearch. The
+   amplitudes are held one per arc, in the order of the neighbour
+   lists, and FusedStep makes one pass over them: at each vertex it
+   adds up the probability, applies the coin and writes the results
+   straight to the reverse arcs of the next state. The three passes of
+   the space matrix (the sum of squares, CoinOperation and
+   TranslationOperation) are kept for comparison in BenchmarkFused,
+   which also times the same three passes over the arcs.
+   ====================================================================
+*/
+
+extern OPTIONS options;
+
+/** MallocArcAmplitudes makes room for one amplitude per arc */
+double *MallocArcAmplitudes(GRAPH *graph)
+{
+  VECDBL amp;
+  int arcs;
+
+  BuildNeighbourLists(graph);
+  arcs = (*graph).nbrstart[(*graph).nodes];
+  MallocVecDbl(&amp,arcs > 0 ? arcs : 1);
+  return(amp);
+}
+
+/** ArcEqualSuperposition is InitialiseEqualSuperposition over the arcs */
+void ArcEqualSuperposition(GRAPH *graph, double *amp)
+{
+  int i, a, d, n = (*graph).nodes;
+
+  for (i = 0; i < n; i++) {
+    d = (*graph).nbrstart[i+1] - (*graph).nbrstart[i];
+    for (a = (*graph).nbrstart[i]; a < (*graph).nbrstart[i+1]; a++)
+      amp[a] = sqrt(1.0/((double)d*n));
+  }
+}
+
+/** ArcSingleVertex is InitialiseSingleVertex over the arcs */
+void ArcSingleVertex(GRAPH *graph, int start, double *amp)
+{
+  int a, d = (*graph).nbrstart[start+1] - (*graph).nbrstart[start];
+
+  memset(amp,0,(*graph).nbrstart[(*graph).nodes] * sizeof(double));
+  for (a = (*graph).nbrstart[start]; a < (*graph).nbrstart[start+1]; a++)
+    amp[a] = sqrt(1.0/d);
+}
+
+/**
+   FusedStep takes the walk one step from amp to next, with the Grover
+   coin, or -I at the marked vertex (-1 for none). If prob is not NULL
+   the probability of each vertex i before the step is put in
+   prob[i][column]. An arc with no reverse arc ends up with nothing.
+   Returns the norm of amp, the sum of the probabilities.
+*/
+WALKKERNEL
+double FusedStep(GRAPH *graph, int marked, double * restrict amp, double * restrict next,
+	       double **prob, int column)
+{
+  int *nbrstart = (*graph).nbrstart, *reverse = (*graph).reverse;
+  int i, a, d, n = (*graph).nodes;
+  double sum, p, norm = 0.0;
+
+  for (i = 0; i < n; i++) {
+    d = nbrstart[i+1] - nbrstart[i];
+    sum = 0.0;
+    p = 0.0;
+    for (a = nbrstart[i]; a < nbrstart[i+1]; a++) {
+      sum += amp[a];
+      p += amp[a]*amp[a];
+    }
+    if (prob != NULL)
+      prob[i][column] = p;
+    norm += p;
+    /** Grover is 2/d times the sum less the amplitude, -I the same
+	with a factor of 0 */
+    sum *= (i == marked || d == 0) ? 0.0 : 2.0/d;
+    for (a = nbrstart[i]; a < nbrstart[i+1]; a++) {
+      if (reverse[a] >= 0)
+	next[reverse[a]] = sum - amp[a];
+      else
+	next[a] = 0.0;
+    }
+  }
+  return(norm);
+}
+
+/**
+   SplitStep is FusedStep as three passes over the arcs, in the order
+   of the space matrix engine: the probabilities, the coin in place,
+   then the shift from amp into next.
+*/
+WALKKERNEL
+void SplitStep(GRAPH *graph, int marked, double * restrict amp, double * restrict next,
+	       double *prob)
+{
+  int *nbrstart = (*graph).nbrstart, *reverse = (*graph).reverse;
+  int i, a, d, n = (*graph).nodes;
+  double sum;
+
+  for (i = 0; i < n; i++) {
+    prob[i] = 0.0;
+    for (a = nbrstart[i]; a < nbrstart[i+1]; a++)
+      prob[i] += amp[a]*amp[a];
+  }
+
+  for (i = 0; i < n; i++) {
+    d = nbrstart[i+1] - nbrstart[i];
+    sum = 0.0;
+    for (a = nbrstart[i]; a < nbrstart[i+1]; a++)
+      sum += amp[a];
+    sum *= (i == marked || d == 0) ? 0.0 : 2.0/d;
+    for (a = nbrstart[i]; a < nbrstart[i+1]; a++)
+      amp[a] = sum - amp[a];
+  }
+
+  for (a = 0; a < nbrstart[n]; a++)
+    next[a] = (reverse[a] >= 0) ? amp[reverse[a]] : 0.0;
+}
+
+/**
+   BenchmarkFused times steps of the walk from -start with the space
+   matrix, with the three passes of SplitStep over the arcs and with
+   FusedStep, and prints the time per step, the memory each step must
+   read and write, and the bandwidth that makes. The memory counts
+   each array a pass goes through once: 8 bytes an amplitude or
+   probability and 4 an index, and for the space matrix the n x n
+   doubles that are summed and copied and the n x n adjacency ints
+   read by the coin and the shift. The last column is the number of
+   blocks allocated during the steps (AllocationCount), which should
+   be 0. The states reached are compared with each other.
+*/
+void BenchmarkFused(GRAPH *graph, QWPARAM *qwparam)
+{
+  MATDBL space = NULL;
+  QWWORKSPACE work;
+  QWPARAM param = *qwparam;
+  int n = (*graph).nodes, arcs, i, j, t, steps;
+  long allocations;
+  double tstart, seconds, bytes, *amp, *next, *check, *prob, *swap, split, matrix;
+  double **column;
+
+  BuildNeighbourLists(graph);
+  arcs = (*graph).nbrstart[n];
+  amp = MallocArcAmplitudes(graph);
+  next = MallocArcAmplitudes(graph);
+  check = MallocArcAmplitudes(graph);
+  prob = malloc(n * sizeof(double));
+  column = malloc(n * sizeof(double *));
+  if (prob == NULL || column == NULL) {
+    fprintf(stderr,"BenchmarkFused: Memory allocation failed.\n");
+    exit(-1);
+  }
+  for (i = 0; i < n; i++)
+    column[i] = &prob[i];
+  fprintf(stderr,"BenchmarkFused: %d vertices, %d arcs\n",n,arcs);
+  fprintf(stderr,"%12s %10s %12s %12s %10s %8s\n","engine","steps","s/step","MB/step","GB/s",
+	  "allocs");
+
+  /** The space matrix: sum of squares, CoinOperation and
+      TranslationOperation, which copies the matrix and reads it back */
+  param.procedure = 'w';
+  param.marked = -1;
+  steps = (n > 1000) ? 5 : 50;
+  MallocMatDbl(&space,n,n);
+  MallocWorkspace(&work,graph);
+  InitialiseSingleVertex(&space,graph,&param);
+  allocations = AllocationCount();
+  tstart = GetRunTime();
+  for (t = 0; t < steps; t++) {
+    for (i = 0; i < n; i++) {
+      prob[i] = 0.0;
+      for (j = 0; j < n; j++)
+	prob[i] += pow(space[i][j],2);
+    }
+    CoinOperation(&space,graph,&param,&work);
+    TranslationOperation(&space,graph,&work);
+  }
+  seconds = (GetRunTime() - tstart) / steps;
+  allocations = AllocationCount() - allocations;
+  bytes = (double)n*n*(8 + 2*4 + 2*8 + 4) + 4*8.0*arcs;
+  fprintf(stderr,"%12s %10d %12.3e %12.3f %10.3f %8ld\n","matrix",steps,seconds,bytes/1e6,
+	  bytes/seconds/1e9,allocations);
+  SpaceToArcs(space,graph,check);
+  FreeWorkspace(&work);
+  FreeMatDbl(&space,n);
+
+  /** Three passes over the arcs, the first with the same steps to
+      compare with the matrix */
+  ArcSingleVertex(graph,param.start,amp);
+  for (t = 0; t < steps; t++) {
+    SplitStep(graph,-1,amp,next,prob);
+    swap = amp;
+    amp = next;
+    next = swap;
+  }
+  for (matrix = 0, i = 0; i < arcs; i++)
+    if (fabs(amp[i] - check[i]) > matrix)
+      matrix = fabs(amp[i] - check[i]);
+
+  steps = (int)(2e7 / (arcs > 0 ? arcs : 1)) + 1;
+  ArcSingleVertex(graph,param.start,amp);
+  allocations = AllocationCount();
+  tstart = GetRunTime();
+  for (t = 0; t < steps; t++) {
+    SplitStep(graph,-1,amp,next,prob);
+    swap = amp;
+    amp = next;
+    next = swap;
+  }
+  seconds = (GetRunTime() - tstart) / steps;
+  allocations = AllocationCount() - allocations;
+  bytes = (4.0*(n+1) + 8*arcs + 8*n) + (4.0*(n+1) + 2*8*arcs) + (4.0*arcs + 2*8*arcs);
+  fprintf(stderr,"%12s %10d %12.3e %12.3f %10.3f %8ld\n","split",steps,seconds,bytes/1e6,
+	  bytes/seconds/1e9,allocations);
+  memcpy(check,amp,(arcs > 0 ? arcs : 0) * sizeof(double));
+
+  /** One pass */
+  ArcSingleVertex(graph,param.start,amp);
+  allocations = AllocationCount();
+  tstart = GetRunTime();
+  for (t = 0; t < steps; t++) {
+    FusedStep(graph,-1,amp,next,column,0);
+    swap = amp;
+    amp = next;
+    next = swap;
+  }
+  seconds = (GetRunTime() - tstart) / steps;
+  allocations = AllocationCount() - allocations;
+  bytes = 4.0*(n+1) + 2*8*arcs + 4.0*arcs + 8*n;
+  fprintf(stderr,"%12s %10d %12.3e %12.3f %10.3f %8ld\n","fused",steps,seconds,bytes/1e6,
+	  bytes/seconds/1e9,allocations);
+  for (split = 0, i = 0; i < arcs; i++)
+    if (fabs(amp[i] - check[i]) > split)
+      split = fabs(amp[i] - check[i]);
+  fprintf(stderr,"BenchmarkFused: largest difference of the arcs from the matrix %.2e, "
+	  "of fused from split %.2e\n",matrix,split);
+
+  free(amp);
+  free(next);
+  free(check);
+  free(prob);
+  free(column);
+}
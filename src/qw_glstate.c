@@ -0,0 +1,88 @@
+/*=======================================================================
+   qwViz - OpenGL visualisation of quantum walks on graphs
+  -----------------------------------------------------------------------
+    Copyright (C) 2011 Scott D. Berry
+    Contact: scottdberry 'at' gmail
+
+    This file is part of qwViz.
+
+    qwViz is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qwViz is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qwViz.  If not, see <http://www.gnu.org/licenses/>.
+  ========================================================================*/
+#include "qwViz.h"
+
+/** 
+   qw_glstate.c keeps a shadow copy of the OpenGL capabilities that are
+   toggled while drawing a frame, so that redundant glEnable/glDisable 
+   calls are never sent, and counts the glEnable/glDisable calls made
+   each frame. Other state calls (lights, materials, colours) are not
+   counted.
+   ====================================================================
+*/
+
+GLSTATE glstate;
+
+static GLenum trackedcaps[GLSTATECAPS] = {
+  GL_LIGHTING, 
+  GL_DEPTH_TEST, 
+  GL_LIGHT0, 
+  GL_LIGHT1
+};
+
+/**
+   InvalidateGLState forgets the shadow state, so that the next request
+   for each capability is always sent. Used before compiling a display 
+   list, which does not change the state at compile time.
+*/
+void InvalidateGLState(void)
+{
+  int i;
+  for (i = 0; i < GLSTATECAPS; i++)
+    glstate.enabled[i] = -1;
+}
+
+/**
+   StartGLStateFrame keeps the enable/disable counts of the frame just drawn for 
+   display and resets the counters for the next one.
+*/
+void StartGLStateFrame(void)
+{
+  glstate.lastissued = glstate.issued;
+  glstate.lastskipped = glstate.skipped;
+  glstate.issued = 0;
+  glstate.skipped = 0;
+}
+
+/**
+   SetGLCapability enables or disables cap, unless the shadow state 
+   shows it is already set. Untracked capabilities are always sent.
+*/
+void SetGLCapability(GLenum cap, int enable)
+{
+  int i;
+
+  for (i = 0; i < GLSTATECAPS; i++)
+    if (trackedcaps[i] == cap)
+      break;
+  if (i < GLSTATECAPS && glstate.enabled[i] == (enable ? 1 : 0)) {
+    glstate.skipped++;
+    return;
+  }
+  if (enable)
+    glEnable(cap);
+  else
+    glDisable(cap);
+  glstate.issued++;
+  if (i < GLSTATECAPS)
+    glstate.enabled[i] = (enable ? 1 : 0);
+}
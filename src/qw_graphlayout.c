@@ -25,7 +25,9 @@ extern OPTIONS options;
 
 /**
    Calls GraphViz routines to position the vertices of a graph structure
-   in 2D, including the allocation of the coordinate lists
+   in 2D, including the allocation of the coordinate lists. The 
+   multilevel and spectral algorithms are native, see qw_forcelayout.c
+   and qw_spectrallayout.c.
 */
 void LayoutGraph(GRAPH *graph)
 {
@@ -47,6 +49,16 @@ void LayoutGraph(GRAPH *graph)
     fprintf(stderr,"LayoutGraph: Using %s algorithm.\n",(*graph).layoutalgorithm);
   }
   MallocCoordinateLists(graph);
+  if (strcmp((*graph).layoutalgorithm,"multilevel") == 0) {
+    MultilevelLayout(graph);
+    NativeBoundingBox(graph);
+    return;
+  }
+  if (strcmp((*graph).layoutalgorithm,"spectral") == 0) {
+    SpectralLayout(graph);
+    NativeBoundingBox(graph);
+    return;
+  }
   nodeArray = malloc( n * sizeof(Agnode_t *));
   if (nodeArray == NULL) {
     fprintf(stderr,"LayoutGraph: NodeArray memory allocation failed.");
@@ -106,6 +118,41 @@ GraphViz...");
     fprintf(stderr,"LayoutGraph: Completed with %d errors.\n",err);
   }
 }
+/**
+  NativeBoundingBox moves a layout made without GraphViz so that its 
+  bounding box starts at the origin, as GraphViz does, then scales it 
+  with ScaleCoordinates.
+*/
+void NativeBoundingBox(GRAPH *graph)
+{
+  NormaliseBoundingBox(graph);
+  ComputeNodeRadius(graph);
+}
+/**
+  NormaliseBoundingBox is NativeBoundingBox without setting the node 
+  radius, for layouts that are not finished yet.
+*/
+void NormaliseBoundingBox(GRAPH *graph)
+{
+  int i;
+  double xmin, xmax, ymin, ymax;
+
+  xmin = xmax = (*graph).Xcoord[0];
+  ymin = ymax = (*graph).Ycoord[0];
+  for (i = 1; i < (*graph).nodes; i++) {
+    if ((*graph).Xcoord[i] < xmin) xmin = (*graph).Xcoord[i];
+    if ((*graph).Xcoord[i] > xmax) xmax = (*graph).Xcoord[i];
+    if ((*graph).Ycoord[i] < ymin) ymin = (*graph).Ycoord[i];
+    if ((*graph).Ycoord[i] > ymax) ymax = (*graph).Ycoord[i];
+  }
+  for (i = 0; i < (*graph).nodes; i++) {
+    (*graph).Xcoord[i] -= xmin;
+    (*graph).Ycoord[i] -= ymin;
+  }
+  if (xmax - xmin <= 0 && ymax - ymin <= 0)
+    xmax = xmin + 1;
+  ScaleCoordinates(graph, xmax - xmin, ymax - ymin);
+}
 /**
   ScaleCoordinates takes the bounding box of the graph calculated from GraphViz and scales the coordinates to fit in the box (-1,-1) -> (1,1)
 */
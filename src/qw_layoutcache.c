@@ -0,0 +1,201 @@
+/*=======================================================================
+   qwViz - OpenGL visualisation of quantum walks on graphs
+  -----------------------------------------------------------------------
+    Copyright (C) 2011 Scott D. Berry
+    Contact: scottdberry 'at' gmail
+
+    This file is part of qwViz.
+
+    qwViz is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qwViz is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qwViz.  If not, see <http://www.gnu.org/licenses/>.
+  ========================================================================*/
+#include <sys/stat.h>
+#include <errno.h>
+#include "qwViz.h"
+
+/**
+   qw_layoutcache.c keeps the vertex coordinates of every graph laid
+   out from an .adj file, so that running qwViz on the same graph
+   again (with a different -start, say) does not run the layout again.
+   A layout is found by the hash of the adjacency structure and the
+   name of the algorithm, which together make the file name, so the
+   name of the .adj file does not matter. The files are in
+   options.cachedir: $QWVIZ_CACHE, or ~/.cache/qwViz, or -cachedir.
+   Each holds a short header, checked on reading, then the scaled
+   Xcoord and Ycoord as they were when LayoutGraph finished.
+   ====================================================================
+*/
+
+extern OPTIONS options;
+
+/**
+   CachedLayoutGraph fills in the coordinates of graph from the cache
+   if it can, and otherwise calls LayoutGraph and saves the result.
+*/
+void CachedLayoutGraph(GRAPH *graph)
+{
+  if (options.cache == FALSE || options.cachedir[0] == '\0') {
+    LayoutGraph(graph);
+    return;
+  }
+  if (ReadLayoutCache(graph) == 0)
+    return;
+  LayoutGraph(graph);
+  WriteLayoutCache(graph);
+}
+
+/**
+   GraphHash is the 64 bit FNV-1a hash of the number of vertices and
+   the neighbour lists, in vertex order, which identifies the graph
+   (but not its automorphisms).
+*/
+unsigned long long GraphHash(GRAPH *graph)
+{
+  unsigned long long hash = QWHASHBASIS;
+  int i, a;
+
+  BuildNeighbourLists(graph);
+  hash = HashBytes(hash,&(*graph).nodes,sizeof(int));
+  for (i = 0; i < (*graph).nodes; i++) {
+    a = (*graph).nbrstart[i+1] - (*graph).nbrstart[i];
+    hash = HashBytes(hash,&a,sizeof(int));
+    hash = HashBytes(hash,&(*graph).nbr[(*graph).nbrstart[i]],a * sizeof(int));
+  }
+  return(hash);
+}
+
+/** HashBytes continues the FNV-1a hash with n more bytes of data */
+unsigned long long HashBytes(unsigned long long hash, void *data, size_t n)
+{
+  unsigned char *byte = data;
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    hash ^= byte[i];
+    hash *= QWHASHPRIME;
+  }
+  return(hash);
+}
+
+/**
+   LayoutCacheName writes the file name of the cached layout of graph
+   with its current algorithm into name, of length size.
+*/
+void LayoutCacheName(GRAPH *graph, char *name, int size)
+{
+  snprintf(name,size,"%s/%016llx-%s.layout",options.cachedir,
+	   GraphHash(graph),(*graph).layoutalgorithm);
+}
+
+/**
+   ReadLayoutCache reads the coordinates of graph from the cache,
+   allocating the coordinate lists. Returns 0 on success, or -1, with
+   nothing allocated, if there is no usable cached layout.
+*/
+int ReadLayoutCache(GRAPH *graph)
+{
+  FILE *fptr;
+  LAYOUTCACHEHEADER header;
+  char name[512];
+  int n = (*graph).nodes;
+
+  LayoutCacheName(graph,name,512);
+  if ((fptr = fopen(name,"rb")) == NULL)
+    return(-1);
+  if (fread(&header,sizeof(LAYOUTCACHEHEADER),1,fptr) != 1 ||
+      strncmp(header.magic,QWLAYOUTMAGIC,8) != 0 ||
+      header.version != QWLAYOUTVERSION || header.nodes != n ||
+      header.hash != GraphHash(graph)) {
+    fprintf(stderr,"ReadLayoutCache: Ignoring \"%s\", not a layout of this graph.\n",name);
+    fclose(fptr);
+    return(-1);
+  }
+  MallocCoordinateLists(graph);
+  if (fread((*graph).Xcoord,sizeof(double),n,fptr) != n ||
+      fread((*graph).Ycoord,sizeof(double),n,fptr) != n) {
+    fprintf(stderr,"ReadLayoutCache: \"%s\" is truncated, ignoring it.\n",name);
+    fclose(fptr);
+    FreeCoordinateLists(graph);
+    return(-1);
+  }
+  fclose(fptr);
+  (*graph).noderadius = header.noderadius;
+  if (options.debug == TRUE)
+    fprintf(stderr,"ReadLayoutCache: Read %s layout from \"%s\".\n",
+	    (*graph).layoutalgorithm,name);
+  return(0);
+}
+
+/**
+   WriteLayoutCache saves the coordinates of graph in the cache. The
+   file is written under a temporary name and renamed, so that another
+   qwViz reading the cache never sees half a layout. Failing to write
+   is only a warning.
+*/
+void WriteLayoutCache(GRAPH *graph)
+{
+  FILE *fptr;
+  LAYOUTCACHEHEADER header;
+  char name[512], tmpname[600];
+  int n = (*graph).nodes, ok;
+
+  if (MakeCacheDirectory(options.cachedir) != 0)
+    return;
+  LayoutCacheName(graph,name,512);
+  snprintf(tmpname,600,"%s.%d",name,(int)getpid());
+  if ((fptr = fopen(tmpname,"wb")) == NULL) {
+    fprintf(stderr,"WriteLayoutCache: Unable to open \"%s\"\n",tmpname);
+    return;
+  }
+  memset(&header,0,sizeof(LAYOUTCACHEHEADER));
+  memcpy(header.magic,QWLAYOUTMAGIC,8);
+  header.version = QWLAYOUTVERSION;
+  header.nodes = n;
+  header.hash = GraphHash(graph);
+  header.noderadius = (*graph).noderadius;
+  ok = (fwrite(&header,sizeof(LAYOUTCACHEHEADER),1,fptr) == 1 &&
+	fwrite((*graph).Xcoord,sizeof(double),n,fptr) == n &&
+	fwrite((*graph).Ycoord,sizeof(double),n,fptr) == n);
+  if (fclose(fptr) != 0)
+    ok = FALSE;
+  if (!ok || rename(tmpname,name) != 0) {
+    fprintf(stderr,"WriteLayoutCache: Unable to write \"%s\"\n",name);
+    remove(tmpname);
+    return;
+  }
+  if (options.debug == TRUE)
+    fprintf(stderr,"WriteLayoutCache: Saved layout in \"%s\".\n",name);
+}
+
+/**
+   MakeCacheDirectory creates dir and any missing parents, like
+   mkdir -p. Returns 0 if the directory exists afterwards.
+*/
+int MakeCacheDirectory(char *dir)
+{
+  char path[512];
+  char *slash;
+
+  strncpy(path,dir,511);
+  path[511] = '\0';
+  for (slash = strchr(path + 1,'/'); slash != NULL; slash = strchr(slash + 1,'/')) {
+    *slash = '\0';
+    mkdir(path,0755);
+    *slash = '/';
+  }
+  if (mkdir(path,0755) != 0 && errno != EEXIST) {
+    fprintf(stderr,"MakeCacheDirectory: Unable to create \"%s\"\n",dir);
+    return(-1);
+  }
+  return(0);
+}
@@ -0,0 +1,202 @@
+/*=======================================================================
+   qwViz - OpenGL visualisation of quantum walks on graphs
+  -----------------------------------------------------------------------
+    Copyright (C) 2011 Scott D. Berry
+    Contact: scottdberry 'at' gmail
+
+    This file is part of qwViz.
+
+    qwViz is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qwViz is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qwViz.  If not, see <http://www.gnu.org/licenses/>.
+  ========================================================================*/
+#include "qwViz.h"
+
+/**
+   qw_layoutthread.c lays out the graph on a worker thread when qwViz
+   opens a window, so that the window appears at once. The vertices
+   start on a circle. The native layouts publish each level of their
+   hierarchy as it is finished, GraphViz only its final result, and
+   every frame HandleIdle moves the drawn vertices part of the way
+   towards the latest published positions.
+   The worker lays out its own copy of the GRAPH, sharing the
+   adjacency matrix and neighbour lists, which nothing changes once
+   the worker has started.
+   ====================================================================
+*/
+
+extern OPTIONS options;
+
+LAYOUTPROGRESS layoutprogress = {FALSE};
+
+/**
+   StartBackgroundLayout gives graph its coordinates from the layout
+   cache if they are there, and otherwise places the vertices on a
+   circle and starts the layout on a worker thread.
+*/
+void StartBackgroundLayout(GRAPH *graph)
+{
+  int i, n = (*graph).nodes;
+
+  if (options.cache == TRUE && options.cachedir[0] != '\0' && ReadLayoutCache(graph) == 0)
+    return;
+
+  MallocCoordinateLists(graph);
+  for (i = 0; i < n; i++) {
+    (*graph).Xcoord[i] = cos(TWOPI * i / n);
+    (*graph).Ycoord[i] = sin(TWOPI * i / n);
+  }
+  NormaliseBoundingBox(graph);
+  (*graph).noderadius = NODERADIUSMIN;
+
+  BuildNeighbourLists(graph);
+  layoutprogress.graph = *graph;
+  layoutprogress.graph.Xcoord = NULL;
+  layoutprogress.graph.Ycoord = NULL;
+  layoutprogress.graph.radiusscale = NULL;
+  layoutprogress.x = malloc(n * sizeof(double));
+  layoutprogress.y = malloc(n * sizeof(double));
+  layoutprogress.targetx = malloc(n * sizeof(double));
+  layoutprogress.targety = malloc(n * sizeof(double));
+  if (layoutprogress.x == NULL || layoutprogress.y == NULL ||
+      layoutprogress.targetx == NULL || layoutprogress.targety == NULL) {
+    fprintf(stderr,"StartBackgroundLayout: Memory allocation failed.\n");
+    exit(-1);
+  }
+  memcpy(layoutprogress.targetx,(*graph).Xcoord,n * sizeof(double));
+  memcpy(layoutprogress.targety,(*graph).Ycoord,n * sizeof(double));
+  layoutprogress.version = 0;
+  layoutprogress.shown = 0;
+  layoutprogress.finished = FALSE;
+  layoutprogress.tstart = GetRunTime();
+  pthread_mutex_init(&layoutprogress.lock,NULL);
+  layoutprogress.active = TRUE;
+  if (pthread_create(&layoutprogress.thread,NULL,LayoutWorker,NULL) != 0) {
+    fprintf(stderr,"StartBackgroundLayout: Unable to start the layout thread.\n");
+    layoutprogress.active = FALSE;
+    FreeBackgroundLayout();
+    FreeCoordinateLists(graph);
+    CachedLayoutGraph(graph);
+  }
+}
+
+/**
+   LayoutWorker is the layout thread. It runs LayoutGraph on the copy
+   of the graph, saves the result in the cache and publishes it.
+*/
+void *LayoutWorker(void *arg)
+{
+  GRAPH *graph = &layoutprogress.graph;
+  int n = (*graph).nodes;
+
+  LayoutGraph(graph);
+  if (options.cache == TRUE && options.cachedir[0] != '\0')
+    WriteLayoutCache(graph);
+  pthread_mutex_lock(&layoutprogress.lock);
+  memcpy(layoutprogress.x,(*graph).Xcoord,n * sizeof(double));
+  memcpy(layoutprogress.y,(*graph).Ycoord,n * sizeof(double));
+  layoutprogress.version++;
+  layoutprogress.finished = TRUE;
+  pthread_mutex_unlock(&layoutprogress.lock);
+  if (options.debug == TRUE)
+    fprintf(stderr,"LayoutWorker: Layout finished after %.2f seconds.\n",
+	    GetRunTime() - layoutprogress.tstart);
+  return(NULL);
+}
+
+/**
+   PublishLayoutLevel offers the coordinates x and y of level l of a
+   layout hierarchy for display, each vertex of the graph drawn where
+   the cluster holding it is. Does nothing unless this is the
+   background layout.
+*/
+void PublishLayoutLevel(LAYOUTLEVEL *levels, int l, double *x, double *y)
+{
+  GRAPH staged;
+  int i, k, a, n = levels[0].n;
+
+  if (layoutprogress.active == FALSE || layoutprogress.finished == TRUE ||
+      levels[0].x != layoutprogress.graph.Xcoord)
+    return;
+  staged.nodes = n;
+  staged.Xcoord = malloc(n * sizeof(double));
+  staged.Ycoord = malloc(n * sizeof(double));
+  if (staged.Xcoord == NULL || staged.Ycoord == NULL) {
+    fprintf(stderr,"PublishLayoutLevel: Memory allocation failed.\n");
+    exit(-1);
+  }
+  for (i = 0; i < n; i++) {
+    a = i;
+    for (k = 0; k < l; k++)
+      a = levels[k].coarse[a];
+    staged.Xcoord[i] = x[a];
+    staged.Ycoord[i] = y[a];
+  }
+  NormaliseBoundingBox(&staged);
+
+  pthread_mutex_lock(&layoutprogress.lock);
+  memcpy(layoutprogress.x,staged.Xcoord,n * sizeof(double));
+  memcpy(layoutprogress.y,staged.Ycoord,n * sizeof(double));
+  layoutprogress.version++;
+  pthread_mutex_unlock(&layoutprogress.lock);
+  free(staged.Xcoord);
+  free(staged.Ycoord);
+}
+
+/**
+   AnimateLayout is called once a frame. It moves the vertices of graph
+   a fraction LAYOUTEASE of the way to the latest published layout, and
+   once the final layout has been reached it stops the worker.
+*/
+void AnimateLayout(GRAPH *graph)
+{
+  int i, n = (*graph).nodes, finished;
+  double dx, dy, maxstep = 0;
+
+  if (layoutprogress.active == FALSE)
+    return;
+  pthread_mutex_lock(&layoutprogress.lock);
+  if (layoutprogress.shown != layoutprogress.version) {
+    memcpy(layoutprogress.targetx,layoutprogress.x,n * sizeof(double));
+    memcpy(layoutprogress.targety,layoutprogress.y,n * sizeof(double));
+    layoutprogress.shown = layoutprogress.version;
+  }
+  finished = layoutprogress.finished;
+  pthread_mutex_unlock(&layoutprogress.lock);
+
+  for (i = 0; i < n; i++) {
+    dx = layoutprogress.targetx[i] - (*graph).Xcoord[i];
+    dy = layoutprogress.targety[i] - (*graph).Ycoord[i];
+    (*graph).Xcoord[i] += LAYOUTEASE * dx;
+    (*graph).Ycoord[i] += LAYOUTEASE * dy;
+    if (fabs(dx) > maxstep) maxstep = fabs(dx);
+    if (fabs(dy) > maxstep) maxstep = fabs(dy);
+  }
+  if (finished && maxstep < 1e-3) {
+    memcpy((*graph).Xcoord,layoutprogress.targetx,n * sizeof(double));
+    memcpy((*graph).Ycoord,layoutprogress.targety,n * sizeof(double));
+    ComputeNodeRadius(graph);
+    pthread_join(layoutprogress.thread,NULL);
+    layoutprogress.active = FALSE;
+    FreeBackgroundLayout();
+  }
+}
+
+void FreeBackgroundLayout(void)
+{
+  FreeCoordinateLists(&layoutprogress.graph);
+  free(layoutprogress.x);
+  free(layoutprogress.y);
+  free(layoutprogress.targetx);
+  free(layoutprogress.targety);
+  pthread_mutex_destroy(&layoutprogress.lock);
+}
@@ -24,12 +24,32 @@
 /** 
    qw_malloc.c contains the dynamic memory handling subprograms for qwViz.
    Failure to allocate memory results in program termination, exit(-1). 
+   Every block allocated here is counted, see AllocationCount.
 */
 
+static long allocations = 0;
+
+/** CountAllocations adds k blocks to the count, from any thread */
+static void CountAllocations(long k)
+{
+  __atomic_fetch_add(&allocations,k,__ATOMIC_RELAXED);
+}
+
+/**
+   AllocationCount is the number of blocks allocated by the functions
+   of qw_malloc.c so far. The benchmarks compare it before and after
+   the steps of a walk.
+*/
+long AllocationCount(void)
+{
+  return(__atomic_load_n(&allocations,__ATOMIC_RELAXED));
+}
+
 void MallocAdjacency(GRAPH *g)
 {
   int i, n;
   n = (*g).nodes;
+  CountAllocations(n + 1);
   (*g).adj = (int **)malloc(n * sizeof(int *));
   if ((*g).adj == NULL) {
     fprintf(stderr,"MallocAdjacency: Memory allocation failed.\n");
@@ -56,10 +76,42 @@ void FreeAdjacency(GRAPH *g)
   (*g).adj = NULL;
 }		
 
+/**
+   MallocNeighbourLists makes room for the neighbour lists of a graph 
+   with arcs directed edges, each undirected edge counted twice.
+*/
+void MallocNeighbourLists(GRAPH *g, int arcs)
+{
+  CountAllocations(3);
+  if (( (*g).nbrstart = malloc(((*g).nodes + 1) * sizeof(int)) ) == NULL) {
+    fprintf(stderr,"MallocNeighbourLists: Memory allocation failed.\n");
+    exit(-1);
+  }
+  if (( (*g).nbr = malloc((arcs > 0 ? arcs : 1) * sizeof(int)) ) == NULL) {
+    fprintf(stderr,"MallocNeighbourLists: Memory allocation failed.\n");
+    exit(-1);
+  }
+  if (( (*g).reverse = malloc((arcs > 0 ? arcs : 1) * sizeof(int)) ) == NULL) {
+    fprintf(stderr,"MallocNeighbourLists: Memory allocation failed.\n");
+    exit(-1);
+  }
+}
+
+void FreeNeighbourLists(GRAPH *g)
+{
+  free((*g).nbrstart);
+  (*g).nbrstart = NULL;
+  free((*g).nbr);
+  (*g).nbr = NULL;
+  free((*g).reverse);
+  (*g).reverse = NULL;
+}
+
 void MallocCoordinateLists(GRAPH *g)
 {
   int n;
   n = (*g).nodes;
+  CountAllocations(2);
   if (( (*g).Xcoord = malloc(n * sizeof(double)) ) == NULL) {
     fprintf(stderr,"MallocCoordinateLists: Memory allocation failed.\n");
     exit(-1);
@@ -76,6 +128,8 @@ void FreeCoordinateLists(GRAPH *g)
   (*g).Xcoord = NULL;
   free((*g).Ycoord);
   (*g).Ycoord = NULL;
+  free((*g).radiusscale);
+  (*g).radiusscale = NULL;
 }
 
 void MallocQWprob(QWDATA *q, GRAPH *g)
@@ -83,6 +137,7 @@ void MallocQWprob(QWDATA *q, GRAPH *g)
   int i, n, t;
   t = (*q).steps;
   n = (*g).nodes;
+  CountAllocations(n + 1);
   (*q).prob = malloc(n * sizeof(double *));
   if ((*q).prob == NULL) {
     fprintf(stderr,"MallocQWprob: Memory allocation failed.\n");
@@ -98,10 +153,11 @@ void MallocQWprob(QWDATA *q, GRAPH *g)
 }
 void FreeQWprob(QWDATA *q, GRAPH *g)
 {
-  int i, n, t;
-  t = (*q).steps;
+  int i, n;
   n = (*g).nodes;
-  for (i = 0; i < t; i++) {
+  if ((*q).prob == NULL)
+    return;
+  for (i = 0; i < n; i++) {
     free((*q).prob[i]);
     (*q).prob[i] = NULL;
   }
@@ -110,6 +166,7 @@ void FreeQWprob(QWDATA *q, GRAPH *g)
 }
 
 void MallocVecInt(VECINT *v, int len) {
+  CountAllocations(1);
   if (( *v = malloc(len * sizeof(int))) == NULL) {
     fprintf(stderr,"QW: MallocVecInt failed");
     exit(-1);
@@ -122,6 +179,7 @@ void FreeVecInt(VECINT *v) {
 }
 
 void MallocVecDbl(VECDBL *v, int len) {
+  CountAllocations(1);
   if (( *v = malloc(len * sizeof(double))) == NULL) {
     fprintf(stderr,"QW: MallocVecInt failed");
     exit(-1);
@@ -135,6 +193,7 @@ void FreeVecDbl(VECDBL *v) {
 
 void MallocMatDbl(MATDBL *mat, int m, int n) {
   int i;
+  CountAllocations(m + 1);
   if ( (*mat = malloc(m * sizeof(double *)) ) == NULL) {
     fprintf(stderr,"QW: MallocMatReal failed");
   }
@@ -155,3 +214,34 @@ void FreeMatDbl(MATDBL *mat, int m) {
   *mat = NULL;
 }
 
+/**
+   MallocWorkspace makes the scratch space of CoinOperation and
+   TranslationOperation for graph, which must not change while it is
+   in use, and fills in the degrees.
+*/
+void MallocWorkspace(QWWORKSPACE *w, GRAPH *g)
+{
+  int i, m;
+
+  (*w).nodes = (*g).nodes;
+  MallocVecInt(&(*w).degree,(*g).nodes > 0 ? (*g).nodes : 1);
+  DegreeVec(&(*w).degree,g);
+  (*w).maxdegree = 0;
+  for (i = 0; i < (*g).nodes; i++)
+    if ((*w).degree[i] > (*w).maxdegree)
+      (*w).maxdegree = (*w).degree[i];
+  m = ((*w).maxdegree > 0) ? (*w).maxdegree : 1;
+  MallocVecDbl(&(*w).v,m);
+  MallocVecDbl(&(*w).vNew,m);
+  MallocMatDbl(&(*w).coin,m,m);
+  MallocMatDbl(&(*w).spaceOld,(*g).nodes,(*g).nodes);
+}
+
+void FreeWorkspace(QWWORKSPACE *w)
+{
+  FreeVecInt(&(*w).degree);
+  FreeVecDbl(&(*w).v);
+  FreeVecDbl(&(*w).vNew);
+  FreeMatDbl(&(*w).coin,((*w).maxdegree > 0) ? (*w).maxdegree : 1);
+  FreeMatDbl(&(*w).spaceOld,(*w).nodes);
+}
@@ -0,0 +1,428 @@
+/*=======================================================================
+   qwViz - OpenGL visualisation of quantum walks on graphs
+  -----------------------------------------------------------------------
+    Copyright (C) 2011 Scott D. Berry
+    Contact: scottdberry 'at' gmail
+
+    This file is part of qwViz.
+
+    qwViz is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qwViz is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qwViz.  If not, see <http://www.gnu.org/licenses/>.
+  ========================================================================*/
+#include "qwViz.h"
+#if defined(__linux__)
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+/** 
+   qw_offscreen.c renders the walk without a window or a display, for 
+   machines such as render farms where GLUT cannot open a window. 
+   A surfaceless EGL context (Mesa) draws into a framebuffer object and
+   every time step is recorded straight to an image file, as fast as the
+   renderer allows rather than at the HandleIdle frame rate.
+   ====================================================================
+*/
+
+extern OPTIONS options;
+extern CAMERA camera;
+extern INTERFACESTATE interfacestate;
+extern GRAPH graph;
+extern QWDATA qwdata;
+
+#if defined(__linux__)
+
+static EGLDisplay egldisplay = EGL_NO_DISPLAY;
+static EGLContext eglcontext = EGL_NO_CONTEXT;
+static GLuint framebuffer = 0;
+static GLuint renderbuffers[2] = {0,0};
+
+/**
+   CreateOffscreenContext makes a surfaceless EGL context with the 
+   desktop OpenGL API current, software rasterised if there is no GPU.
+   Returns 0 on success.
+*/
+int CreateOffscreenContext(void)
+{
+  PFNEGLGETPLATFORMDISPLAYEXTPROC getplatformdisplay;
+  EGLint major, minor;
+
+  getplatformdisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)
+    eglGetProcAddress("eglGetPlatformDisplayEXT");
+  if (getplatformdisplay != NULL)
+    egldisplay = getplatformdisplay(EGL_PLATFORM_SURFACELESS_MESA,
+				    EGL_DEFAULT_DISPLAY,NULL);
+  if (egldisplay == EGL_NO_DISPLAY)
+    egldisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+  if (egldisplay == EGL_NO_DISPLAY || !eglInitialize(egldisplay,&major,&minor)) {
+    fprintf(stderr,"CreateOffscreenContext: Unable to initialise EGL.\n");
+    return(-1);
+  }
+  if (!eglBindAPI(EGL_OPENGL_API)) {
+    fprintf(stderr,"CreateOffscreenContext: EGL does not support OpenGL.\n");
+    return(-1);
+  }
+  eglcontext = eglCreateContext(egldisplay,EGL_NO_CONFIG_KHR,EGL_NO_CONTEXT,NULL);
+  if (eglcontext == EGL_NO_CONTEXT) {
+    fprintf(stderr,"CreateOffscreenContext: Unable to create context (0x%x).\n",
+	    eglGetError());
+    return(-1);
+  }
+  if (!eglMakeCurrent(egldisplay,EGL_NO_SURFACE,EGL_NO_SURFACE,eglcontext)) {
+    fprintf(stderr,"CreateOffscreenContext: Unable to make context current.\n");
+    return(-1);
+  }
+  if (options.debug)
+    fprintf(stderr,"CreateOffscreenContext: EGL %d.%d, %s, OpenGL %s\n",
+	    major,minor,glGetString(GL_RENDERER),glGetString(GL_VERSION));
+  return(0);
+}
+
+void DestroyOffscreenContext(void)
+{
+  eglMakeCurrent(egldisplay,EGL_NO_SURFACE,EGL_NO_SURFACE,EGL_NO_CONTEXT);
+  eglDestroyContext(egldisplay,eglcontext);
+  eglTerminate(egldisplay);
+  eglcontext = EGL_NO_CONTEXT;
+  egldisplay = EGL_NO_DISPLAY;
+}
+
+/**
+   CreateOffscreenBuffer creates and binds a width x height framebuffer 
+   object with colour and depth renderbuffers. Returns 0 on success.
+*/
+int CreateOffscreenBuffer(int width, int height)
+{
+  GLenum status;
+
+  glGenFramebuffers(1,&framebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER,framebuffer);
+  glGenRenderbuffers(2,renderbuffers);
+  glBindRenderbuffer(GL_RENDERBUFFER,renderbuffers[0]);
+  glRenderbufferStorage(GL_RENDERBUFFER,GL_RGBA8,width,height);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,
+			    GL_RENDERBUFFER,renderbuffers[0]);
+  glBindRenderbuffer(GL_RENDERBUFFER,renderbuffers[1]);
+  glRenderbufferStorage(GL_RENDERBUFFER,GL_DEPTH_COMPONENT24,width,height);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER,GL_DEPTH_ATTACHMENT,
+			    GL_RENDERBUFFER,renderbuffers[1]);
+  status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+  if (status != GL_FRAMEBUFFER_COMPLETE) {
+    fprintf(stderr,"CreateOffscreenBuffer: %d x %d framebuffer incomplete (0x%x).\n",
+	    width,height,status);
+    return(-1);
+  }
+  glReadBuffer(GL_COLOR_ATTACHMENT0);
+  return(0);
+}
+
+void DestroyOffscreenBuffer(void)
+{
+  glBindFramebuffer(GL_FRAMEBUFFER,0);
+  glDeleteRenderbuffers(2,renderbuffers);
+  glDeleteFramebuffers(1,&framebuffer);
+  framebuffer = 0;
+}
+
+#endif /* __linux__ */
+
+/**
+   DrawOffscreenFrame draws the graph and the data for time step t and 
+   sub-step subt from the centre of the camera, into a buffer of width
+   x height, a whole multiple of the screen size when supersampling.
+   The overlays drawn by DrawExtras use GLUT fonts and are left out.
+*/
+void DrawOffscreenFrame(int t, int subt, int width, int height)
+{
+  DrawOffscreenTile(t,subt,0,0,width,height,width,height);
+}
+
+/**
+   DrawOffscreenTile draws the tw x th pixels at (x0,y0) of a width x
+   height image into the bottom left of the buffer, by narrowing the 
+   frustum to that part of the view.
+*/
+void DrawOffscreenTile(int t, int subt, int x0, int y0, int tw, int th,
+		       int width, int height)
+{
+  double ratio,radians,wd2,left,bottom;
+
+  ratio   = width / (double)height;
+  radians = DTOR * camera.aperture / 2;
+  wd2     = camera.near * tan(radians);
+  left    = -ratio*wd2;
+  bottom  = -wd2;
+
+  glViewport(0,0,tw,th);
+  glMatrixMode(GL_PROJECTION);
+  glLoadIdentity();
+  glFrustum(left + 2*ratio*wd2*x0/width,left + 2*ratio*wd2*(x0+tw)/width,
+	    bottom + 2*wd2*y0/height,bottom + 2*wd2*(y0+th)/height,
+	    camera.near,camera.far);
+  glMatrixMode(GL_MODELVIEW);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  glLoadIdentity();
+  gluLookAt(camera.vp.x,camera.vp.y,camera.vp.z,
+	    camera.vp.x + camera.vd.x,
+	    camera.vp.y + camera.vd.y,
+	    camera.vp.z + camera.vd.z,
+	    camera.vu.x,camera.vu.y,camera.vu.z);
+  CreateLighting();
+  CreateGeometry(t, subt, &graph, &qwdata);
+}
+
+/**
+   RenderOffscreen renders every time step (and every sub-step when 
+   interpolating with -i) at camera.screenwidth x camera.screenheight 
+   and writes each to an image file. With -supersample k the frames are
+   rendered k times larger and filtered down for smooth edges.
+*/
+void RenderOffscreen(void)
+{
+#if defined(__linux__)
+  int frame, frames, width, height;
+  double tstart;
+
+  camera.stereo = NOSTEREO;
+  width = camera.screenwidth * options.supersample;
+  height = camera.screenheight * options.supersample;
+  if (CreateOffscreenContext() != 0 ||
+      CreateOffscreenBuffer(width,height) != 0) {
+    fprintf(stderr,"RenderOffscreen: Offscreen rendering is not available.\n");
+    exit(-1);
+  }
+  CreateEnvironment();
+  CameraHome(0);
+  RotateCamera(0.0,30.0,0.0,1.0);
+  if (options.bench) {
+    BenchmarkImageWriter();
+    DestroyOffscreenBuffer();
+    DestroyOffscreenContext();
+    return;
+  }
+  StartRecording(GL_COLOR_ATTACHMENT0,GL_COLOR_ATTACHMENT0,FALSE,options.supersample);
+
+  /** The last step has nothing to interpolate towards */
+  frames = (qwdata.steps - 1) * options.subframes + 1;
+  tstart = GetRunTime();
+  for (frame = 0; frame < frames; frame++) {
+    interfacestate.currenttime = frame / options.subframes;
+    interfacestate.currentsubframe = frame % options.subframes;
+    DrawOffscreenFrame(interfacestate.currenttime,interfacestate.currentsubframe,
+		       width,height);
+    RecordFrame(width,height,FALSE,ImageFormat());
+    if (options.autorotate != 0)
+      RotateCamera(1.0,0.0,0.0,options.autorotate/50.0);
+    if (options.debug)
+      fprintf(stderr,"RenderOffscreen: Frame %d of %d\n",frame+1,frames);
+  }
+  FinishRecording();
+  fprintf(stderr,"RenderOffscreen: %d frames at %d x %d in %.2f seconds\n",
+	  frames,camera.screenwidth,camera.screenheight,GetRunTime()-tstart);
+
+  DestroyOffscreenBuffer();
+  DestroyOffscreenContext();
+#else
+  fprintf(stderr,"RenderOffscreen: Offscreen rendering needs EGL, \
+which is not available on this platform.\n");
+  exit(-1);
+#endif
+}
+
+/**
+   BenchmarkImageWriter times Write_Bitmap in compressed TGA format on 
+   a rendered frame at 1920 x 1080 and 3840 x 2160, with one thread and 
+   with options.threads, and checks that both give the same file.
+*/
+void BenchmarkImageWriter(void)
+{
+#if defined(__linux__)
+  int sizes[2][2] = {{1920,1080},{3840,2160}};
+  int i, k, r, repeats = 10;
+  double tserial, tparallel, tstart;
+  long length, serial = 0;
+  BITMAP4 *image = NULL;
+  FILE *fptr;
+  char *buffer[2] = {NULL,NULL};
+
+  for (i = 0; i < 2; i++) {
+    camera.screenwidth = sizes[i][0];
+    camera.screenheight = sizes[i][1];
+    DestroyOffscreenBuffer();
+    if (CreateOffscreenBuffer(camera.screenwidth,camera.screenheight) != 0) {
+      fprintf(stderr,"BenchmarkImageWriter: Unable to create a %d x %d buffer\n",
+	      camera.screenwidth,camera.screenheight);
+      exit(-1);
+    }
+    if ((image = Create_Bitmap(camera.screenwidth,camera.screenheight)) == NULL) {
+      fprintf(stderr,"BenchmarkImageWriter: Failed to allocate memory for image\n");
+      exit(-1);
+    }
+    DrawOffscreenFrame(qwdata.steps/2,0,camera.screenwidth,camera.screenheight);
+    glPixelStorei(GL_PACK_ALIGNMENT,1);
+    glReadPixels(0,0,camera.screenwidth,camera.screenheight,
+		 GL_RGBA,GL_UNSIGNED_BYTE,image);
+
+    for (k = 0; k < 2; k++) {
+      SetParallelThreads(k == 0 ? 1 : options.threads);
+      if ((fptr = tmpfile()) == NULL) {
+	fprintf(stderr,"BenchmarkImageWriter: Unable to open a temporary file\n");
+	exit(-1);
+      }
+      tstart = GetRunTime();
+      for (r = 0; r < repeats; r++) {
+	rewind(fptr);
+	Write_Bitmap(fptr,image,camera.screenwidth,camera.screenheight,12);
+	fflush(fptr);
+      }
+      if (k == 0) {
+	tserial = (GetRunTime() - tstart) / repeats;
+	serial = ftell(fptr);
+      } else {
+	tparallel = (GetRunTime() - tstart) / repeats;
+      }
+      length = ftell(fptr);
+      buffer[k] = malloc(length);
+      rewind(fptr);
+      if (buffer[k] == NULL || fread(buffer[k],1,length,fptr) != (size_t)length) {
+	fprintf(stderr,"BenchmarkImageWriter: Unable to read back the image\n");
+	exit(-1);
+      }
+      fclose(fptr);
+    }
+    fprintf(stderr,"BenchmarkImageWriter: %d x %d TGA (%ld bytes), 1 thread %.1f ms, \
+%d threads %.1f ms, speedup %.2f, %s\n",
+	    camera.screenwidth,camera.screenheight,serial,1000*tserial,
+	    options.threads,1000*tparallel,tserial/tparallel,
+	    (length == serial && memcmp(buffer[0],buffer[1],length) == 0) ? 
+	    "identical" : "DIFFERENT");
+    free(buffer[0]);
+    free(buffer[1]);
+    Destroy_Bitmap(image);
+  }
+  SetParallelThreads(options.threads);
+#endif
+}
+
+/**
+   TiledScreenshot renders time step t as one width x height image, 
+   larger than any framebuffer, written to fname. The view is drawn in
+   POSTERTILE square tiles, a band of tiles at a time, and each band is
+   streamed to the file so only one band is ever held in memory.
+   Returns 0 on success.
+*/
+int TiledScreenshot(char *fname, int width, int height, int t, int format)
+{
+#if defined(__linux__)
+  int tile, band, nbands, index, x0, y0, tw, th;
+  GLint maxsize;
+  BITMAP4 *image = NULL;
+  BITMAPSTREAM stream;
+  FILE *fptr;
+
+  glGetIntegerv(GL_MAX_RENDERBUFFER_SIZE,&maxsize);
+  tile = (maxsize < POSTERTILE) ? maxsize : POSTERTILE;
+  if (CreateOffscreenBuffer(tile,tile) != 0)
+    return(-1);
+  if ((image = Create_Bitmap(width,tile)) == NULL) {
+    fprintf(stderr,"TiledScreenshot: Failed to allocate memory for %d x %d band\n",
+	    width,tile);
+    DestroyOffscreenBuffer();
+    return(-1);
+  }
+  if ((fptr = fopen(fname,"wb")) == NULL) {
+    fprintf(stderr,"TiledScreenshot: Failed to open %s\n",fname);
+    Destroy_Bitmap(image);
+    DestroyOffscreenBuffer();
+    return(-1);
+  }
+  setvbuf(fptr,NULL,_IOFBF,RECORDBUFSIZE);
+  if (Open_BitmapStream(&stream,fptr,width,height,format) != 0) {
+    fclose(fptr);
+    Destroy_Bitmap(image);
+    DestroyOffscreenBuffer();
+    return(-1);
+  }
+
+  /** Flipped formats store the top row first, the others the bottom */
+  nbands = (height + tile - 1) / tile;
+  glPixelStorei(GL_PACK_ALIGNMENT,1);
+  glPixelStorei(GL_PACK_ROW_LENGTH,width);
+  for (band = 0; band < nbands; band++) {
+    index = (format < 0) ? nbands - 1 - band : band;
+    y0 = index * tile;
+    th = (height - y0 < tile) ? height - y0 : tile;
+    for (x0 = 0; x0 < width; x0 += tile) {
+      tw = (width - x0 < tile) ? width - x0 : tile;
+      DrawOffscreenTile(t,0,x0,y0,tw,th,width,height);
+      glReadPixels(0,0,tw,th,GL_RGBA,GL_UNSIGNED_BYTE,&(image[x0]));
+    }
+    Write_BitmapStream(&stream,image,th);
+    if (options.debug)
+      fprintf(stderr,"TiledScreenshot: Band %d of %d\n",band+1,nbands);
+  }
+  glPixelStorei(GL_PACK_ROW_LENGTH,0);
+  Close_BitmapStream(&stream);
+  fclose(fptr);
+
+  Destroy_Bitmap(image);
+  DestroyOffscreenBuffer();
+  return(0);
+#else
+  return(-1);
+#endif
+}
+
+/**
+   RenderPoster writes a single -poster sized image of one time step,
+   the last unless another is given, without opening a window.
+*/
+void RenderPoster(void)
+{
+#if defined(__linux__)
+  int t, format;
+  char fname[64];
+  double tstart;
+
+  camera.stereo = NOSTEREO;
+  camera.screenwidth = options.posterwidth;
+  camera.screenheight = options.posterheight;
+  if (CreateOffscreenContext() != 0) {
+    fprintf(stderr,"RenderPoster: Offscreen rendering is not available.\n");
+    exit(-1);
+  }
+  CreateEnvironment();
+  CameraHome(0);
+  RotateCamera(0.0,30.0,0.0,1.0);
+
+  /** -poster counts walk steps, and only every stride-th is stored */
+  t = (options.postertime < 0) ? -1 : options.postertime / qwdata.stride;
+  if (t < 0 || t >= qwdata.steps)
+    t = qwdata.steps - 1;
+  format = ImageFormat();
+  sprintf(fname,"poster_%04d.%s",FirstFreeImage("poster_",0,ImageExtension(format)),
+	  ImageExtension(format));
+  tstart = GetRunTime();
+  if (TiledScreenshot(fname,options.posterwidth,options.posterheight,t,format) != 0) {
+    fprintf(stderr,"RenderPoster: Unable to render %s\n",fname);
+    exit(-1);
+  }
+  fprintf(stderr,"RenderPoster: %s, time step %d at %d x %d in %.2f seconds\n",
+	  fname,t * qwdata.stride,options.posterwidth,options.posterheight,GetRunTime()-tstart);
+  DestroyOffscreenContext();
+#else
+  fprintf(stderr,"RenderPoster: Offscreen rendering needs EGL, \
+which is not available on this platform.\n");
+  exit(-1);
+#endif
+}
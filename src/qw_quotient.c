@@ -0,0 +1,317 @@
+/*=======================================================================
+   qwViz - OpenGL visualisation of quantum walks on graphs
+  -----------------------------------------------------------------------
+    Copyright (C) 2011 Scott D. Berry
+    Contact: scottdberry 'at' gmail
+
+    This file is part of qwViz.
+
+    qwViz is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qwViz is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qwViz.  If not, see <http://www.gnu.org/licenses/>.
+  ========================================================================*/
+#include "qwViz.h"
+
+/**
+   qw_quotient.c simulates the walk (-symmetry) on the quotient of the
+   graph by its coarsest equitable partition with the start or marked
+   vertex in a cell of its own. Every vertex of a cell A has the same
+   number b_AB of neighbours in cell B, and the initial states of
+   QuantumWalk and QuantumSearch give the same amplitude x_AB to every
+   arc from A to B. The Grover coin and the shift keep it that way:
+      coin   x_AB <- (2/d_A) sum_C b_AC x_AC - x_AB  (-x_AB if marked)
+      shift  x_AB <- x_BA
+   so only one amplitude per pair of adjacent cells is needed, and each
+   vertex of A is found with probability sum_B b_AB x_AB^2. On Cayley
+   trees and glued trees there are a few cells per level, and the walk
+   costs almost nothing beside filling in qwdata.prob.
+   ====================================================================
+*/
+
+extern OPTIONS options;
+
+/**
+   QuotientWalk runs QuantumWalk or QuantumSearch, as given by
+   qwparam.procedure, on the quotient graph and fills in qwdata.prob
+   for every vertex. qwdata.prob is allocated here but not freed.
+*/
+void QuotientWalk(GRAPH *graph, QWDATA *qwdata, QWPARAM *qwparam)
+{
+  QUOTIENT q;
+  int n = (*graph).nodes, *cell, *qarc = NULL, special, A, a, i, t = 0;
+  double *x, *y, *p, *swap, *state, sum, norm, tstart = GetRunTime();
+  NORMDRIFT drift;
+
+  BuildNeighbourLists(graph);
+  for (a = 0; a < (*graph).nbrstart[n]; a++)
+    if ((*graph).reverse[a] < 0) {
+      fprintf(stderr,"QuotientWalk: The adjacency matrix is not symmetric, -symmetry ignored.\n");
+      if ((*qwparam).procedure == 's')
+	QuantumSearch(graph,qwdata,qwparam);
+      else
+	QuantumWalk(graph,qwdata,qwparam);
+      return;
+    }
+
+  special = ((*qwparam).procedure == 's') ? (*qwparam).marked : (*qwparam).start;
+  if ((cell = malloc(n * sizeof(int))) == NULL) {
+    fprintf(stderr,"QuotientWalk: Memory allocation failed.\n");
+    exit(-1);
+  }
+  BuildQuotient(graph,EquitablePartition(graph,special,cell),cell,&q);
+  x = malloc((q.arcs > 0 ? q.arcs : 1) * sizeof(double));
+  y = malloc((q.arcs > 0 ? q.arcs : 1) * sizeof(double));
+  p = malloc(q.cells * sizeof(double));
+  if (x == NULL || y == NULL || p == NULL) {
+    fprintf(stderr,"QuotientWalk: Memory allocation failed.\n");
+    exit(-1);
+  }
+
+  /** The states of InitialiseEqualSuperposition and InitialiseSingleVertex */
+  for (A = 0; A < q.cells; A++)
+    for (a = q.start[A]; a < q.start[A+1]; a++) {
+      if ((*qwparam).procedure == 's')
+	x[a] = sqrt(1.0/((double)q.degree[A]*n));
+      else
+	x[a] = (A == cell[special]) ? sqrt(1.0/q.degree[A]) : 0.0;
+    }
+
+  MallocQWprob(qwdata,graph);
+  InitialiseNormDrift(&drift);
+  /** A checkpoint holds every arc of the graph, each with the
+      amplitude of its pair of cells */
+  if ((state = MallocCheckpointState(graph,qwparam)) != NULL) {
+    if ((qarc = malloc(((*graph).nbrstart[n] > 0 ? (*graph).nbrstart[n] : 1) * sizeof(int))) == NULL) {
+      fprintf(stderr,"QuotientWalk: Memory allocation failed.\n");
+      exit(-1);
+    }
+    for (i = 0; i < n; i++)
+      for (a = (*graph).nbrstart[i]; a < (*graph).nbrstart[i+1]; a++)
+	qarc[a] = QuotientArc(&q,cell[i],cell[(*graph).nbr[a]]);
+    if ((t = ReadCheckpoint(graph,qwdata,qwparam,state)) > 0)
+      for (a = 0; a < (*graph).nbrstart[n]; a++)
+	x[qarc[a]] = state[a];
+  }
+  for (; t < (*qwdata).steps * (*qwdata).stride; t++) {
+    if (t % (*qwdata).stride == 0) {
+      for (A = 0; A < q.cells; A++) {
+	p[A] = 0.0;
+	for (a = q.start[A]; a < q.start[A+1]; a++)
+	  p[A] += q.count[a] * x[a] * x[a];
+      }
+      norm = 0.0;
+      for (i = 0; i < n; i++) {
+	(*qwdata).prob[i][t/(*qwdata).stride] = p[cell[i]];
+	norm += p[cell[i]];
+      }
+      if (CheckNorm(&drift,norm,t) && (*qwparam).renormalise == TRUE) {
+	ScaleAmplitudes(x,q.arcs,1.0/sqrt(norm));
+	drift.renormalised += 1;
+      }
+    }
+
+    /** Grover coin, -I at the marked vertex */
+    for (A = 0; A < q.cells; A++) {
+      if ((*qwparam).procedure == 's' && A == cell[special]) {
+	for (a = q.start[A]; a < q.start[A+1]; a++)
+	  x[a] = -x[a];
+	continue;
+      }
+      if (q.degree[A] == 0)
+	continue;
+      sum = 0.0;
+      for (a = q.start[A]; a < q.start[A+1]; a++)
+	sum += q.count[a] * x[a];
+      sum *= 2.0/q.degree[A];
+      for (a = q.start[A]; a < q.start[A+1]; a++)
+	x[a] = sum - x[a];
+    }
+
+    /** Shift: x_AB takes the amplitude of x_BA */
+    for (a = 0; a < q.arcs; a++)
+      y[a] = x[q.reverse[a]];
+    swap = x;
+    x = y;
+    y = swap;
+    if (state != NULL && CheckpointDue(qwdata,qwparam,t+1)) {
+      for (a = 0; a < (*graph).nbrstart[n]; a++)
+	state[a] = x[qarc[a]];
+      WriteCheckpoint(graph,qwdata,qwparam,state,t+1);
+    }
+  }
+  ReportNormDrift(&drift,"QuotientWalk");
+  if (options.debug == TRUE)
+    fprintf(stderr,"QuotientWalk: %d vertices in %d cells, %d quotient arcs, %d steps in %.3f seconds.\n",
+	    n,q.cells,q.arcs,(*qwdata).steps * (*qwdata).stride,GetRunTime() - tstart);
+
+  free(x);
+  free(y);
+  free(p);
+  free(cell);
+  free(state);
+  free(qarc);
+  FreeQuotient(&q);
+}
+
+/**
+   EquitablePartition sets cell[i] to the cell of vertex i in the
+   coarsest equitable partition in which vertex special (if it exists)
+   is alone, and returns the number of cells. Cells are split by colour
+   refinement: two vertices of a cell stay together while they have the
+   same number of neighbours in every cell.
+*/
+int EquitablePartition(GRAPH *graph, int special, int *cell)
+{
+  int n = (*graph).nodes, *nbrstart = (*graph).nbrstart;
+  int *sig, *newcell, *table, size, cells, oldcells, i, j, a, d, slot;
+  unsigned long long hash;
+
+  for (size = 1; size < 2*n; size *= 2)
+    ;
+  sig = malloc(((*graph).nbrstart[n] > 0 ? (*graph).nbrstart[n] : 1) * sizeof(int));
+  newcell = malloc(n * sizeof(int));
+  table = malloc(size * sizeof(int));
+  if (sig == NULL || newcell == NULL || table == NULL) {
+    fprintf(stderr,"EquitablePartition: Memory allocation failed.\n");
+    exit(-1);
+  }
+  for (i = 0; i < n; i++)
+    cell[i] = (i == special) ? 1 : 0;
+  cells = (special >= 0 && special < n && n > 1) ? 2 : 1;
+
+  do {
+    oldcells = cells;
+    /** The signature of i is its cell and its neighbours' cells, sorted */
+    for (a = 0; a < nbrstart[n]; a++)
+      sig[a] = cell[(*graph).nbr[a]];
+    for (i = 0; i < n; i++)
+      qsort(&sig[nbrstart[i]],nbrstart[i+1] - nbrstart[i],sizeof(int),CompareInts);
+
+    /** Vertices with equal signatures share a new cell, found by hash */
+    for (slot = 0; slot < size; slot++)
+      table[slot] = -1;
+    cells = 0;
+    for (i = 0; i < n; i++) {
+      d = nbrstart[i+1] - nbrstart[i];
+      hash = HashBytes(QWHASHBASIS,&cell[i],sizeof(int));
+      hash = HashBytes(hash,&sig[nbrstart[i]],d * sizeof(int));
+      for (slot = hash & (size - 1); table[slot] >= 0; slot = (slot + 1) & (size - 1)) {
+	j = table[slot];
+	if (cell[j] == cell[i] && nbrstart[j+1] - nbrstart[j] == d &&
+	    memcmp(&sig[nbrstart[j]],&sig[nbrstart[i]],d * sizeof(int)) == 0)
+	  break;
+      }
+      if (table[slot] < 0) {
+	table[slot] = i;
+	newcell[i] = cells++;
+      } else
+	newcell[i] = newcell[table[slot]];
+    }
+    memcpy(cell,newcell,n * sizeof(int));
+  } while (cells != oldcells);
+
+  free(sig);
+  free(newcell);
+  free(table);
+  return(cells);
+}
+
+/**
+   BuildQuotient fills q with the quotient graph of the equitable
+   partition cell with cells cells, read from one vertex of each cell.
+*/
+void BuildQuotient(GRAPH *graph, int cells, int *cell, QUOTIENT *q)
+{
+  int n = (*graph).nodes, *rep, *sorted, A, a, b, i, d, most = 1;
+
+  rep = malloc(cells * sizeof(int));
+  (*q).start = malloc((cells + 1) * sizeof(int));
+  (*q).degree = malloc(cells * sizeof(int));
+  if (rep == NULL || (*q).start == NULL || (*q).degree == NULL) {
+    fprintf(stderr,"BuildQuotient: Memory allocation failed.\n");
+    exit(-1);
+  }
+  (*q).cells = cells;
+  for (i = n - 1; i >= 0; i--)
+    rep[cell[i]] = i;
+  for (A = 0; A < cells; A++) {
+    (*q).degree[A] = (*graph).nbrstart[rep[A]+1] - (*graph).nbrstart[rep[A]];
+    if ((*q).degree[A] > most)
+      most = (*q).degree[A];
+  }
+  (*q).nbr = malloc(((*graph).nbrstart[n] > 0 ? (*graph).nbrstart[n] : 1) * sizeof(int));
+  (*q).count = malloc(((*graph).nbrstart[n] > 0 ? (*graph).nbrstart[n] : 1) * sizeof(int));
+  sorted = malloc(most * sizeof(int));
+  if ((*q).nbr == NULL || (*q).count == NULL || sorted == NULL) {
+    fprintf(stderr,"BuildQuotient: Memory allocation failed.\n");
+    exit(-1);
+  }
+
+  /** The cells next to each cell, in order, with their multiplicity */
+  (*q).arcs = 0;
+  for (A = 0; A < cells; A++) {
+    (*q).start[A] = (*q).arcs;
+    i = rep[A];
+    d = (*q).degree[A];
+    for (b = 0; b < d; b++)
+      sorted[b] = cell[(*graph).nbr[(*graph).nbrstart[i] + b]];
+    qsort(sorted,d,sizeof(int),CompareInts);
+    for (b = 0; b < d; b++) {
+      if (b == 0 || sorted[b] != sorted[b-1]) {
+	(*q).nbr[(*q).arcs] = sorted[b];
+	(*q).count[(*q).arcs++] = 0;
+      }
+      (*q).count[(*q).arcs - 1]++;
+    }
+  }
+  (*q).start[cells] = (*q).arcs;
+  (*q).reverse = malloc(((*q).arcs > 0 ? (*q).arcs : 1) * sizeof(int));
+  if ((*q).reverse == NULL) {
+    fprintf(stderr,"BuildQuotient: Memory allocation failed.\n");
+    exit(-1);
+  }
+
+  /** The cells of each list are in order, so B -> A is found by bisection */
+  for (A = 0; A < cells; A++)
+    for (a = (*q).start[A]; a < (*q).start[A+1]; a++)
+      (*q).reverse[a] = QuotientArc(q,(*q).nbr[a],A);
+  free(rep);
+  free(sorted);
+}
+
+/** QuotientArc is the arc of q from cell A to cell B */
+int QuotientArc(QUOTIENT *q, int A, int B)
+{
+  int lo = (*q).start[A], hi = (*q).start[A+1], mid;
+
+  while (hi - lo > 1 && (*q).nbr[lo] != B) {
+    mid = (lo + hi) / 2;
+    if ((*q).nbr[mid] <= B) lo = mid;
+    else hi = mid;
+  }
+  return(lo);
+}
+
+void FreeQuotient(QUOTIENT *q)
+{
+  free((*q).start);
+  free((*q).degree);
+  free((*q).nbr);
+  free((*q).count);
+  free((*q).reverse);
+}
+
+/** CompareInts orders ints for qsort */
+int CompareInts(const void *a, const void *b)
+{
+  return((*(const int *)a > *(const int *)b) - (*(const int *)a < *(const int *)b));
+}
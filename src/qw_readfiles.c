@@ -67,6 +67,12 @@ int ReadQWML(QWFILE *qwfile, QWDATA *qwdata, GRAPH *graph)
 	  fprintf(stderr,"ReadQWML: Found \"probdist\" tag.\n");
 	err += StoreProb(qwdata,qwfile);
 
+      } else if (strcmp(tag,"stride") == 0) {
+	if (options.debug) 
+	  fprintf(stderr,"ReadQWML: Found \"stride\" tag.\n");
+	if (((*qwdata).stride = atoi(data)) < 1)
+	  (*qwdata).stride = 1;
+
       } else if (strcmp(tag,"graphlayout") == 0) {
 	if (options.debug) 
 	  fprintf(stderr,"ReadQWML: Found \"graphlayout\" tag.\n");
@@ -0,0 +1,438 @@
+/*=======================================================================
+   qwViz - OpenGL visualisation of quantum walks on graphs
+  -----------------------------------------------------------------------
+    Copyright (C) 2011 Scott D. Berry
+    Contact: scottdberry 'at' gmail
+
+    This file is part of qwViz.
+
+    qwViz is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qwViz is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qwViz.  If not, see <http://www.gnu.org/licenses/>.
+  ========================================================================*/
+#include "qwViz.h"
+
+/** 
+   qw_record.c writes a continuous sequence of frames (options.record 
+   and the offscreen renderer) without stalling the renderer. 
+   Each frame is read back into one of a ring of pixel buffer objects, 
+   and only mapped a few frames later when the transfer has finished. 
+   The pixels are copied into a reusable image buffer and put on a 
+   bounded queue, which a pool of encoder threads drains in parallel, 
+   each one writing whole image files.
+   With -y4m the frames are instead written, in order, as one 
+   uncompressed YUV4MPEG2 stream that a video encoder can read from a 
+   pipe. The stream stays open between recordings.
+   ====================================================================
+*/
+
+extern OPTIONS options;
+
+RECORDER recorder;
+
+static FILE *stream = NULL;
+static int streamwidth = 0;
+static int streamheight = 0;
+
+/**
+   ImageFormat returns the Write_Bitmap format used for window dumps 
+   and recordings: compressed TGA, or TIFF or PNG with -tiff or -png.
+   These two store the top row first so are flipped.
+*/
+int ImageFormat(void)
+{
+  if (options.exporttiff)
+    return(-5);
+  if (options.exportpng)
+    return(-14);
+  return(12);
+}
+
+/**
+   ImageExtension returns the file extension for a Write_Bitmap format.
+*/
+char *ImageExtension(int format)
+{
+  switch (ABS(format)) {
+  case 2: return("ppm");
+  case 3: return("rgb");
+  case 4: 
+  case 8: return("raw");
+  case 5: return("tif");
+  case 6: 
+  case 7: return("eps");
+  case 9: return("bmp");
+  case 14:
+  case 15: return("png");
+  }
+  return("tga");
+}
+
+/**
+   EncodeFrames is run by each encoder thread. It writes queued frames 
+   to disk and returns their image buffers to the free list, until told
+   to quit and the queue is empty.
+*/
+void *EncodeFrames(void *arg)
+{
+  RECORDFRAME frame;
+  BITMAP4 *pooled, *small;
+  FILE *fptr;
+
+  /** Frames are already encoded in parallel, one per encoder */
+  if (recorder.nencoders > 1)
+    MarkParallelWorker();
+  pthread_mutex_lock(&recorder.lock);
+  for (;;) {
+    while (recorder.queuelength == 0 && !recorder.quit)
+      pthread_cond_wait(&recorder.changed,&recorder.lock);
+    if (recorder.queuelength == 0)
+      break;
+    frame = recorder.queue[recorder.queuestart];
+    recorder.queuestart = (recorder.queuestart + 1) % RECORDIMAGES;
+    recorder.queuelength--;
+    pthread_mutex_unlock(&recorder.lock);
+
+    /** Supersampled frames are filtered down to their final size */
+    pooled = frame.image;
+    small = NULL;
+    if (frame.supersample > 1) {
+      if ((small = Create_Bitmap(frame.width/frame.supersample,
+				 frame.height/frame.supersample)) == NULL) {
+	fprintf(stderr,"EncodeFrames: Failed to allocate memory for image\n");
+	exit(-1);
+      }
+      GaussianScale(frame.image,frame.width,frame.height,small,
+		    frame.width/frame.supersample,frame.height/frame.supersample,
+		    0.5*frame.supersample);
+      frame.image = small;
+      frame.width /= frame.supersample;
+      frame.height /= frame.supersample;
+    }
+
+    if (frame.sequence >= 0) {
+      StreamFrame(&frame);
+    } else if ((fptr = fopen(frame.fname,"wb")) == NULL) {
+      fprintf(stderr,"EncodeFrames: Failed to open %s\n",frame.fname);
+    } else {
+      setvbuf(fptr,NULL,_IOFBF,RECORDBUFSIZE);
+      Write_Bitmap(fptr,frame.image,frame.width,frame.height,frame.format);
+      fclose(fptr);
+    }
+
+    if (small != NULL)
+      Destroy_Bitmap(small);
+    pthread_mutex_lock(&recorder.lock);
+    recorder.freeimages[recorder.nfree++] = pooled;
+    pthread_cond_broadcast(&recorder.changed);
+  }
+  pthread_mutex_unlock(&recorder.lock);
+  return(NULL);
+}
+
+/**
+   StreamFrame converts a frame to YUV 4:2:0 and appends it to the 
+   stream once every earlier frame has been written, so that several 
+   encoders keep the frames in order.
+*/
+void StreamFrame(RECORDFRAME *frame)
+{
+  unsigned char *yuv;
+  long size;
+
+  size = (long)frame->width * frame->height 
+    + 2L * ((frame->width+1)/2) * ((frame->height+1)/2);
+  if ((yuv = malloc(size)) == NULL) {
+    fprintf(stderr,"StreamFrame: Failed to allocate memory for frame\n");
+    exit(-1);
+  }
+  Bitmap_to_YUV420(frame->image,frame->width,frame->height,yuv,TRUE);
+
+  pthread_mutex_lock(&recorder.lock);
+  while (recorder.nextsequence != frame->sequence)
+    pthread_cond_wait(&recorder.changed,&recorder.lock);
+  pthread_mutex_unlock(&recorder.lock);
+
+  fprintf(stream,"FRAME\n");
+  if (fwrite(yuv,1,size,stream) != (size_t)size)
+    fprintf(stderr,"StreamFrame: Failed to write frame %d\n",frame->sequence);
+  free(yuv);
+
+  pthread_mutex_lock(&recorder.lock);
+  recorder.nextsequence++;
+  pthread_cond_broadcast(&recorder.changed);
+  pthread_mutex_unlock(&recorder.lock);
+}
+
+/**
+   OpenStream opens the -y4m stream, "-" for standard output, and 
+   writes its header. Every frame must then be width x height.
+*/
+void OpenStream(int width, int height)
+{
+  if (strcmp(options.streamname,"-") == 0) {
+    stream = stdout;
+  } else if ((stream = fopen(options.streamname,"wb")) == NULL) {
+    fprintf(stderr,"OpenStream: Unable to open %s\n",options.streamname);
+    exit(-1);
+  }
+  setvbuf(stream,NULL,_IOFBF,RECORDBUFSIZE);
+  fprintf(stream,"YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n",
+	  width,height,(int)options.targetfps);
+  streamwidth = width;
+  streamheight = height;
+}
+
+/**
+   GetRecordImage returns a free image buffer of the current size, 
+   allocating up to RECORDIMAGES of them and then waiting for an 
+   encoder to give one back. This is what bounds the queue.
+*/
+BITMAP4 *GetRecordImage(void)
+{
+  BITMAP4 *image = NULL;
+
+  pthread_mutex_lock(&recorder.lock);
+  while (recorder.nfree == 0 && recorder.nimages == RECORDIMAGES)
+    pthread_cond_wait(&recorder.changed,&recorder.lock);
+  if (recorder.nfree > 0) {
+    image = recorder.freeimages[--recorder.nfree];
+  } else {
+    if ((image = Create_Bitmap(recorder.width,recorder.height)) == NULL) {
+      fprintf(stderr,"GetRecordImage: Failed to allocate memory for image\n");
+      exit(-1);
+    }
+    recorder.nimages++;
+  }
+  pthread_mutex_unlock(&recorder.lock);
+  return(image);
+}
+
+/**
+   CompleteReadback maps the pixel buffer of a finished readback, copies
+   it into an image buffer and queues that for the encoder.
+*/
+void CompleteReadback(int slot)
+{
+  RECORDFRAME frame;
+  void *pixels;
+
+  frame = recorder.inflight[slot];
+  frame.image = GetRecordImage();
+  glBindBuffer(GL_PIXEL_PACK_BUFFER,recorder.pbo[slot]);
+  pixels = glMapBuffer(GL_PIXEL_PACK_BUFFER,GL_READ_ONLY);
+  if (pixels != NULL) {
+    memcpy(frame.image,pixels,frame.width*frame.height*sizeof(BITMAP4));
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+  } else {
+    fprintf(stderr,"CompleteReadback: Unable to map pixel buffer\n");
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER,0);
+  recorder.pending[slot] = FALSE;
+
+  pthread_mutex_lock(&recorder.lock);
+  recorder.queue[(recorder.queuestart + recorder.queuelength) % RECORDIMAGES] = frame;
+  recorder.queuelength++;
+  pthread_cond_broadcast(&recorder.changed);
+  pthread_mutex_unlock(&recorder.lock);
+}
+
+/**
+   CompleteAllReadbacks finishes every readback still in flight, oldest
+   first so the encoder receives frames in order.
+*/
+void CompleteAllReadbacks(void)
+{
+  int i, slot;
+
+  for (i = 0; i < RECORDPBOS; i++) {
+    slot = (recorder.head + i) % RECORDPBOS;
+    if (recorder.pending[slot])
+      CompleteReadback(slot);
+  }
+}
+
+/**
+   IssueReadback starts an asynchronous read of buffer into the next 
+   pixel buffer of the ring, first completing the readback that was 
+   last made into it. A NULL fname sends the frame to the stream.
+*/
+void IssueReadback(GLenum buffer, char *fname, int format)
+{
+  int slot = recorder.head;
+
+  if (recorder.pending[slot])
+    CompleteReadback(slot);
+  glPixelStorei(GL_PACK_ALIGNMENT,1);
+  glReadBuffer(buffer);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER,recorder.pbo[slot]);
+  glReadPixels(0,0,recorder.width,recorder.height,GL_RGBA,GL_UNSIGNED_BYTE,0);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER,0);
+
+  if (fname != NULL) {
+    strcpy(recorder.inflight[slot].fname,fname);
+    recorder.inflight[slot].sequence = -1;
+  } else {
+    recorder.inflight[slot].sequence = recorder.frames;
+  }
+  recorder.inflight[slot].format = format;
+  recorder.inflight[slot].width = recorder.width;
+  recorder.inflight[slot].height = recorder.height;
+  recorder.inflight[slot].supersample = recorder.supersample;
+  recorder.pending[slot] = TRUE;
+  recorder.head = (slot + 1) % RECORDPBOS;
+}
+
+/**
+   ResizeRecording makes the pixel buffers and image buffers match a 
+   new frame size, once all frames of the old size have been written.
+*/
+void ResizeRecording(int width, int height)
+{
+  int i;
+
+  CompleteAllReadbacks();
+  pthread_mutex_lock(&recorder.lock);
+  while (recorder.nfree < recorder.nimages)
+    pthread_cond_wait(&recorder.changed,&recorder.lock);
+  for (i = 0; i < recorder.nfree; i++)
+    Destroy_Bitmap(recorder.freeimages[i]);
+  recorder.nfree = 0;
+  recorder.nimages = 0;
+  recorder.width = width;
+  recorder.height = height;
+  pthread_mutex_unlock(&recorder.lock);
+
+  for (i = 0; i < RECORDPBOS; i++) {
+    glBindBuffer(GL_PIXEL_PACK_BUFFER,recorder.pbo[i]);
+    glBufferData(GL_PIXEL_PACK_BUFFER,width*height*sizeof(BITMAP4),NULL,GL_STREAM_READ);
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER,0);
+}
+
+/**
+   StartRecording sets up the pixel buffers and starts options.threads
+   encoders. left and right are the buffers read for each eye. If 
+   findfree is TRUE existing files are never overwritten, as for
+   WindowDump, otherwise frames are numbered from zero. Frames 
+   rendered supersample times larger than wanted are scaled down by 
+   the encoders.
+*/
+void StartRecording(GLenum left, GLenum right, int findfree, int supersample)
+{
+  int i;
+
+  if (recorder.active)
+    return;
+  memset(&recorder,0,sizeof(RECORDER));
+  recorder.readbuffer[0] = left;
+  recorder.readbuffer[1] = right;
+  recorder.findfree = findfree;
+  recorder.supersample = supersample;
+  glGenBuffers(RECORDPBOS,recorder.pbo);
+  for (i = 0; i < RECORDPBOS; i++)
+    recorder.pending[i] = FALSE;
+  pthread_mutex_init(&recorder.lock,NULL);
+  pthread_cond_init(&recorder.changed,NULL);
+  recorder.nencoders = options.threads;
+  if (recorder.nencoders > RECORDENCODERS)
+    recorder.nencoders = RECORDENCODERS;
+  for (i = 0; i < recorder.nencoders; i++) {
+    if (pthread_create(&recorder.encoders[i],NULL,EncodeFrames,NULL) != 0) {
+      fprintf(stderr,"StartRecording: Unable to start encoder thread %d\n",i);
+      exit(-1);
+    }
+  }
+  recorder.tstart = GetRunTime();
+  recorder.active = TRUE;
+}
+
+/**
+   RecordFrame queues the current frame, both eyes if stereo, for 
+   writing to disk. Starts a window recording if none is active.
+   The first free file number is only searched for once, after which
+   frames are named straight from the counter.
+*/
+int RecordFrame(int width, int height, int stereo, int format)
+{
+  char fname[64];
+  char *ext;
+
+  if (!recorder.active)
+    StartRecording(GL_BACK_LEFT,GL_BACK_RIGHT,TRUE,1);
+  if (width != recorder.width || height != recorder.height)
+    ResizeRecording(width,height);
+
+  /** A stream has one size and one view, the left eye in stereo */
+  if (options.streamname[0] != '\0') {
+    if (stream == NULL)
+      OpenStream(width/recorder.supersample,height/recorder.supersample);
+    if (width/recorder.supersample != streamwidth || 
+	height/recorder.supersample != streamheight) {
+      if (options.debug)
+	fprintf(stderr,"RecordFrame: Frame skipped, the stream is %d x %d\n",
+		streamwidth,streamheight);
+      return(FALSE);
+    }
+    IssueReadback(recorder.readbuffer[0],NULL,format);
+    recorder.frames++;
+    return(TRUE);
+  }
+
+  ext = ImageExtension(format);
+  /** Each frame checks its own names, as existing files may have gaps */
+  if (recorder.findfree)
+    recorder.counter = FirstFreeFrame(stereo,recorder.counter,ext);
+  if (stereo) {
+    sprintf(fname,"L_%04d.%s",recorder.counter,ext);
+    IssueReadback(recorder.readbuffer[0],fname,format);
+    sprintf(fname,"R_%04d.%s",recorder.counter,ext);
+    IssueReadback(recorder.readbuffer[1],fname,format);
+  } else {
+    sprintf(fname,"%04d.%s",recorder.counter,ext);
+    IssueReadback(recorder.readbuffer[0],fname,format);
+  }
+  recorder.counter++;
+  recorder.frames++;
+  return(TRUE);
+}
+
+/**
+   FinishRecording writes out every frame still in flight or queued, 
+   stops the encoder and releases the buffers.
+*/
+void FinishRecording(void)
+{
+  int i;
+
+  if (!recorder.active)
+    return;
+  CompleteAllReadbacks();
+  pthread_mutex_lock(&recorder.lock);
+  recorder.quit = TRUE;
+  pthread_cond_broadcast(&recorder.changed);
+  pthread_mutex_unlock(&recorder.lock);
+  for (i = 0; i < recorder.nencoders; i++)
+    pthread_join(recorder.encoders[i],NULL);
+  if (stream != NULL)
+    fflush(stream);
+
+  for (i = 0; i < recorder.nfree; i++)
+    Destroy_Bitmap(recorder.freeimages[i]);
+  glDeleteBuffers(RECORDPBOS,recorder.pbo);
+  pthread_mutex_destroy(&recorder.lock);
+  pthread_cond_destroy(&recorder.changed);
+  recorder.active = FALSE;
+  if (options.debug)
+    fprintf(stderr,"FinishRecording: %d frames in %.2f seconds, %d encoders\n",
+	    recorder.frames,GetRunTime()-recorder.tstart,recorder.nencoders);
+}
@@ -29,6 +29,7 @@
 extern CAMERA camera;
 extern OPTIONS options;
 extern char *interfacestring;
+extern GLSTATE glstate;
 
 COLOUR colourmap[MAPPINGSIZE];
 
@@ -40,13 +41,17 @@ COLOUR colourmap[MAPPINGSIZE];
 void CreateGeometry(int t, int subt, GRAPH *graph, QWDATA *qwdata)
 {
   int i, j;
+  int tnext;
   XYZ node, top, up = {0,0,1};
-  COLOUR c;
-  float scaleFactor;
+  COLOUR *c;
+  float scaleFactor, radius;
 
   scaleFactor = (float)subt/(float)options.subframes;
+  tnext = (t+1 < (*qwdata).steps) ? t+1 : t;
 
-  CreateLighting();
+  SetGLCapability(GL_LIGHTING,TRUE);
+  SetGLCapability(GL_DEPTH_TEST,TRUE);
+  ComputeColourMap();
   if ((*graph).firstrender == TRUE) {
     glLineWidth(1.0);
     glPointSize(1.0);
@@ -76,11 +81,14 @@ void CreateGeometry(int t, int subt, GRAPH *graph, QWDATA *qwdata)
     top.x = (*graph).Xcoord[i];
     top.y = (*graph).Ycoord[i];
     top.z = ((*qwdata).prob[i][t]*(1.0 - scaleFactor)
-	     + (*qwdata).prob[i][t+1]*scaleFactor)/(*qwdata).scalemax;
-    c = GetColour(top.z,0.0,(*qwdata).scalemax,options.colourscheme);
-    glColor3f(c.r,c.g,c.b);
-    CreateCone(node,top,(*graph).noderadius,(*graph).noderadius,40,0.0,TWOPI);
-    CreateDisk(top,up,0.0,(*graph).noderadius,40,0.0,TWOPI);
+	     + (*qwdata).prob[i][tnext]*scaleFactor)/(*qwdata).scalemax;
+    c = LookupColour(top.z,(*qwdata).scalemax);
+    glColor3f((*c).r,(*c).g,(*c).b);
+    radius = (*graph).noderadius;
+    if ((*graph).radiusscale != NULL)
+      radius *= (*graph).radiusscale[i];
+    CreateCone(node,top,radius,radius,40,0.0,TWOPI);
+    CreateDisk(top,up,0.0,radius,40,0.0,TWOPI);
   }
   if (options.showarrow) {
     CreateVertexArrow(graph);
@@ -92,28 +100,140 @@ void CreateGeometry(int t, int subt, GRAPH *graph, QWDATA *qwdata)
 
 /**
   Compute the radius of the cylinders to represent the quantum walk
-  data. (max = 0.05, min = 0.015).
+  data (max = 0.05, min = 0.015) from the smallest distance between 
+  two vertices. With -localradius each vertex also gets its own radius 
+  from the distance to its nearest neighbour, stored as a multiple of 
+  noderadius in radiusscale so that the c and v keys still scale them 
+  all.
 */
 void ComputeNodeRadius(GRAPH *graph)
 {
-  int i, j;
-  float minSepSq;
-  float sepSq;
+  int i, n = (*graph).nodes;
+  double *nn, minsep = 4 * NODERADIUSMAX, r;
 
-  minSepSq = 1.0;
-  for (i = 0; i < (*graph).nodes; i++)
-    for (j = 0; j < (*graph).nodes; j++) {
-      if (i != j) {
-	sepSq = pow((*graph).Xcoord[i] - (*graph).Xcoord[j],2) 
-	  + pow((*graph).Ycoord[i] - (*graph).Ycoord[j],2);
-	if (sepSq < minSepSq) minSepSq = sepSq;
+  if ((nn = malloc((n > 0 ? n : 1) * sizeof(double))) == NULL) {
+    fprintf(stderr,"ComputeNodeRadius: Memory allocation failed.\n");
+    exit(-1);
+  }
+  NearestNeighbourDistances(graph,4 * NODERADIUSMAX,nn);
+  for (i = 0; i < n; i++)
+    if (nn[i] < minsep) minsep = nn[i];
+  (*graph).noderadius = minsep/4;
+  if ((*graph).noderadius < NODERADIUSMIN)
+    (*graph).noderadius = NODERADIUSMIN;
+  if ((*graph).noderadius > NODERADIUSMAX)
+    (*graph).noderadius = NODERADIUSMAX;
+
+  free((*graph).radiusscale);
+  (*graph).radiusscale = NULL;
+  if (options.localradius == TRUE && n > 0) {
+    if (((*graph).radiusscale = malloc(n * sizeof(float))) == NULL) {
+      fprintf(stderr,"ComputeNodeRadius: Memory allocation failed.\n");
+      exit(-1);
+    }
+    for (i = 0; i < n; i++) {
+      r = nn[i]/4;
+      if (r < NODERADIUSMIN) r = NODERADIUSMIN;
+      if (r > NODERADIUSMAX) r = NODERADIUSMAX;
+      (*graph).radiusscale[i] = r / (*graph).noderadius;
+    }
+  }
+  free(nn);
+}
+
+/**
+  NearestNeighbourDistances sets nn[i] to the distance from vertex i to 
+  the nearest other vertex, or to maxdist if there is none closer. The 
+  vertices are sorted into a grid of cells holding about one vertex 
+  each, and the search around each vertex spreads out ring by ring 
+  until no nearer vertex can be found, so the whole search is close to 
+  linear rather than comparing every pair.
+*/
+void NearestNeighbourDistances(GRAPH *graph, double maxdist, double *nn)
+{
+  NEARESTPASS pass;
+  int i, n = (*graph).nodes;
+  double xmin, xmax, ymin, ymax, area;
+
+  if (n < 2) {
+    for (i = 0; i < n; i++)
+      nn[i] = maxdist;
+    return;
+  }
+  xmin = xmax = (*graph).Xcoord[0];
+  ymin = ymax = (*graph).Ycoord[0];
+  for (i = 1; i < n; i++) {
+    if ((*graph).Xcoord[i] < xmin) xmin = (*graph).Xcoord[i];
+    if ((*graph).Xcoord[i] > xmax) xmax = (*graph).Xcoord[i];
+    if ((*graph).Ycoord[i] < ymin) ymin = (*graph).Ycoord[i];
+    if ((*graph).Ycoord[i] > ymax) ymax = (*graph).Ycoord[i];
+  }
+  area = (xmax - xmin) * (ymax - ymin);
+  if (area <= 0)
+    area = pow((xmax - xmin) + (ymax - ymin),2);
+
+  /** The grid of qw_forcelayout.c, cells at least cutoff wide */
+  pass.points.n = n;
+  pass.points.x = (*graph).Xcoord;
+  pass.points.y = (*graph).Ycoord;
+  pass.grid.level = &pass.points;
+  pass.grid.cutoff = sqrt(area / n);
+  if (pass.grid.cutoff <= 0)
+    pass.grid.cutoff = maxdist;
+  pass.grid.cellstart = NULL;
+  pass.grid.cellvertex = malloc(n * sizeof(int));
+  if (pass.grid.cellvertex == NULL) {
+    fprintf(stderr,"NearestNeighbourDistances: Memory allocation failed.\n");
+    exit(-1);
+  }
+  BuildForceGrid(&pass.grid);
+  pass.maxdist = maxdist;
+  pass.nn = nn;
+  ParallelFor(n,NearestNeighbourRows,&pass);
+  free(pass.grid.cellvertex);
+  free(pass.grid.cellstart);
+}
+
+/**
+  NearestNeighbourRows is the search of NearestNeighbourDistances for 
+  vertices start to end-1. Every vertex in ring r of cells around a 
+  vertex's own cell is at least (r-1) cells away, which ends the search.
+*/
+void NearestNeighbourRows(int start, int end, void *arg)
+{
+  NEARESTPASS *pass = arg;
+  FORCEPASS *grid = &(*pass).grid;
+  double *x = (*pass).points.x, *y = (*pass).points.y;
+  int i, j, a, c, r, cx, cy, gx, gy, step;
+  double best, d2, h = (*grid).cellsize;
+
+  for (i = start; i < end; i++) {
+    best = (*pass).maxdist * (*pass).maxdist;
+    cx = (int)((x[i] - (*grid).xmin) / h);
+    cy = (int)((y[i] - (*grid).ymin) / h);
+    for (r = 0; r <= (*grid).gridx + (*grid).gridy; r++) {
+      if (r > 1 && pow((r-1) * h,2) >= best)
+	break;
+      for (gy = cy - r; gy <= cy + r; gy++) {
+	if (gy < 0 || gy >= (*grid).gridy)
+	  continue;
+	/** Only the cells on the edge of the ring are new */
+	step = (gy == cy - r || gy == cy + r) ? 1 : 2 * r;
+	for (gx = cx - r; gx <= cx + r; gx += step) {
+	  if (gx < 0 || gx >= (*grid).gridx)
+	    continue;
+	  c = gy * (*grid).gridx + gx;
+	  for (a = (*grid).cellstart[c]; a < (*grid).cellstart[c+1]; a++) {
+	    j = (*grid).cellvertex[a];
+	    d2 = (x[i] - x[j])*(x[i] - x[j]) + (y[i] - y[j])*(y[i] - y[j]);
+	    if (j != i && d2 < best)
+	      best = d2;
+	  }
+	}
       }
     }
-  (*graph).noderadius = sqrt(minSepSq)/4;
-  if ((*graph).noderadius < 0.015)
-    (*graph).noderadius = 0.015;
-  if ((*graph).noderadius > 0.05)
-    (*graph).noderadius = 0.05;
+    (*pass).nn[i] = sqrt(best);
+  }
 }
 
 /**
@@ -134,14 +254,35 @@ void ComputeMaxProb(QWDATA *qwdata, GRAPH *graph)
 
 /**
   ComputeColourMap uses GetColour (paulslib) to compute the colours 
-  for the scale.
+  for the scale and the vertex cylinders. The table is only rebuilt 
+  when options.colourscheme changes.
 */
 void ComputeColourMap(void)
 {
+  static int mapscheme = 0;
   int i = 0;
+
+  if (mapscheme == options.colourscheme)
+    return;
   for (i = 0; i < MAPPINGSIZE; i++) {
     colourmap[i] = GetColour((double)i,0.0,(double)MAPPINGSIZE,options.colourscheme);
   }
+  mapscheme = options.colourscheme;
+}
+
+/**
+  LookupColour returns the colourmap entry for v in the range 0 to vmax,
+  quantised to MAPPINGSIZE levels and clipped at either end.
+*/
+COLOUR *LookupColour(double v, double vmax)
+{
+  int index = 0;
+
+  if (vmax > 0.0 && v > 0.0)
+    index = (int)(v/vmax*MAPPINGSIZE);
+  if (index >= MAPPINGSIZE)
+    index = MAPPINGSIZE-1;
+  return(&colourmap[index]);
 }
 
 /**
@@ -152,31 +293,30 @@ void DrawExtras(INTERFACESTATE interfacestate, QWDATA *qwdata)
 {
   char s[64];
 
+  /** None of the overlays are lit, CreateGeometry turns lighting back on */
+  SetGLCapability(GL_LIGHTING,FALSE);
+
   if (options.showarrow) {
     LabelVertex();
   }
 
-  if (interfacestate.currenttime == 0)
-    ComputeColourMap();
-  
   if (options.showinfo) {
-    glDisable(GL_LIGHTING);
     glColor3f(1.0,1.0,1.0);
     sprintf(s,"Frame rate: %.1f fps",interfacestate.framerate);
     DrawGLText(10,10,s);
-    sprintf(s,"t = %d",interfacestate.currenttime);
+    sprintf(s,"t = %d",interfacestate.currenttime * (*qwdata).stride +
+	    interfacestate.currentsubframe * (*qwdata).stride / options.subframes);
     DrawGLText(10,25,s);
-    glDisable(GL_DEPTH_TEST);
+    sprintf(s,"glEnable/glDisable calls: %d issued, %d skipped",
+	    glstate.lastissued,glstate.lastskipped);
+    DrawGLText(10,55,s);
+    SetGLCapability(GL_DEPTH_TEST,FALSE);
     DrawScale(qwdata,colourmap);
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_LIGHTING);
   }
 
   if (options.showhelp) {
-    glDisable(GL_LIGHTING);
     glColor3f(1.0,1.0,1.0);
     DrawGLText(10,camera.screenheight-20,interfacestring);
-    glEnable(GL_LIGHTING);
   }
 
 }
@@ -280,7 +420,6 @@ void CreateVertexArrow(GRAPH *graph)
   float stemradius = 0.02;
   float headradius = 0.04;
 
-  CreateLighting();
   top.x = (*graph).Xcoord[options.labelledvertex];
   top.y = (*graph).Ycoord[options.labelledvertex];
   top.z = -offset;
@@ -300,9 +439,8 @@ void CreateVertexArrow(GRAPH *graph)
 void LabelVertex(void)
 {
   char s[64];
-  glDisable(GL_LIGHTING);
+  SetGLCapability(GL_LIGHTING,FALSE);
   glColor3f(1.0,1.0,1.0);
   sprintf(s,"Vertex %d",options.labelledvertex+1);
   DrawGLText(10,40,s);
-  glEnable(GL_LIGHTING);
 }
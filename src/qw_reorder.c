@@ -0,0 +1,483 @@
+/*=======================================================================
+   qwViz - OpenGL visualisation of quantum walks on graphs
+  -----------------------------------------------------------------------
+    Copyright (C) 2011 Scott D. Berry
+    Contact: scottdberry 'at' gmail
+
+    This file is part of qwViz.
+
+    qwViz is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qwViz is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qwViz.  If not, see <http://www.gnu.org/licenses/>.
+  ========================================================================*/
+#include "qwViz.h"
+
+/**
+   qw_reorder.c renumbers the vertices (-reorder) in reverse
+   Cuthill-McKee order before the walk, so that neighbours have nearby
+   numbers and the shift, which moves the amplitude of each arc to its
+   reverse, reads memory close to where it writes. The vertices read
+   from the .adj file keep their numbers everywhere else: the walk is
+   computed on the renumbered graph and RestoreGraphOrder puts the
+   adjacency matrix and qwdata.prob back before anything is written
+   or drawn.
+   ====================================================================
+*/
+
+extern OPTIONS options;
+
+/**
+   ReorderGraph renumbers the vertices of graph in reverse
+   Cuthill-McKee order, and qwparam.start and qwparam.marked with
+   them. graph.order[i] is the number, counting from 0, in the file of
+   the vertex that is now i.
+*/
+void ReorderGraph(GRAPH *graph, QWPARAM *qwparam)
+{
+  int n = (*graph).nodes, *position, i, before;
+
+  BuildNeighbourLists(graph);
+  before = GraphBandwidth(graph);
+  (*graph).order = malloc((n > 0 ? n : 1) * sizeof(int));
+  position = malloc((n > 0 ? n : 1) * sizeof(int));
+  if ((*graph).order == NULL || position == NULL) {
+    fprintf(stderr,"ReorderGraph: Memory allocation failed.\n");
+    exit(-1);
+  }
+  ReverseCuthillMcKee(graph,(*graph).order);
+  for (i = 0; i < n; i++)
+    position[(*graph).order[i]] = i;
+  PermuteAdjacency(graph,(*graph).order);
+  FreeNeighbourLists(graph);
+  BuildNeighbourLists(graph);
+  if ((*qwparam).start >= 0 && (*qwparam).start < n)
+    (*qwparam).start = position[(*qwparam).start];
+  if ((*qwparam).marked >= 0 && (*qwparam).marked < n)
+    (*qwparam).marked = position[(*qwparam).marked];
+  if (options.debug == TRUE)
+    fprintf(stderr,"ReorderGraph: Bandwidth %d as read, %d in reverse Cuthill-McKee order.\n",
+	    before,GraphBandwidth(graph));
+  free(position);
+}
+
+/**
+   RestoreGraphOrder undoes ReorderGraph, giving the vertices, the rows
+   of qwdata.prob (if qwdata is not NULL), qwparam.start and
+   qwparam.marked their numbers in the file. Does nothing if the graph
+   has not been reordered.
+*/
+void RestoreGraphOrder(GRAPH *graph, QWDATA *qwdata, QWPARAM *qwparam)
+{
+  int n = (*graph).nodes, *order = (*graph).order, *position, i;
+  double **rows;
+
+  if (order == NULL)
+    return;
+  position = malloc((n > 0 ? n : 1) * sizeof(int));
+  if (position == NULL) {
+    fprintf(stderr,"RestoreGraphOrder: Memory allocation failed.\n");
+    exit(-1);
+  }
+  for (i = 0; i < n; i++)
+    position[order[i]] = i;
+  PermuteAdjacency(graph,position);
+  FreeNeighbourLists(graph);
+  if (qwdata != NULL && (*qwdata).prob != NULL) {
+    if ((rows = malloc(n * sizeof(double *))) == NULL) {
+      fprintf(stderr,"RestoreGraphOrder: Memory allocation failed.\n");
+      exit(-1);
+    }
+    for (i = 0; i < n; i++)
+      rows[order[i]] = (*qwdata).prob[i];
+    memcpy((*qwdata).prob,rows,n * sizeof(double *));
+    free(rows);
+  }
+  if ((*qwparam).start >= 0 && (*qwparam).start < n)
+    (*qwparam).start = order[(*qwparam).start];
+  if ((*qwparam).marked >= 0 && (*qwparam).marked < n)
+    (*qwparam).marked = order[(*qwparam).marked];
+  free(order);
+  (*graph).order = NULL;
+  free(position);
+}
+
+/**
+   PermuteAdjacency renumbers the vertices of the adjacency matrix so
+   that vertex i is the old vertex perm[i]. The neighbour lists are not
+   changed.
+*/
+void PermuteAdjacency(GRAPH *graph, int *perm)
+{
+  int n = (*graph).nodes, i, j, *row, **rows;
+
+  row = malloc((n > 0 ? n : 1) * sizeof(int));
+  rows = malloc((n > 0 ? n : 1) * sizeof(int *));
+  if (row == NULL || rows == NULL) {
+    fprintf(stderr,"PermuteAdjacency: Memory allocation failed.\n");
+    exit(-1);
+  }
+  for (i = 0; i < n; i++) {
+    for (j = 0; j < n; j++)
+      row[j] = (*graph).adj[i][perm[j]];
+    memcpy((*graph).adj[i],row,n * sizeof(int));
+  }
+  for (i = 0; i < n; i++)
+    rows[i] = (*graph).adj[perm[i]];
+  memcpy((*graph).adj,rows,n * sizeof(int *));
+  free(row);
+  free(rows);
+}
+
+/**
+   ReverseCuthillMcKee fills order with the vertices of graph in
+   reverse Cuthill-McKee order: each connected component numbered
+   breadth first from a vertex at the end of a longest shortest path
+   (found as by George and Liu), the neighbours of each vertex taken in
+   order of degree, and the whole order reversed.
+*/
+void ReverseCuthillMcKee(GRAPH *graph, int *order)
+{
+  int n = (*graph).nodes, *mark, *queue, *placed, s, i, root, next, count = 0;
+  int stamp = 0, depth, newdepth, last, size, tries;
+
+  mark = malloc((n > 0 ? n : 1) * sizeof(int));
+  queue = malloc((n > 0 ? n : 1) * sizeof(int));
+  placed = calloc((n > 0 ? n : 1),sizeof(int));
+  if (mark == NULL || queue == NULL || placed == NULL) {
+    fprintf(stderr,"ReverseCuthillMcKee: Memory allocation failed.\n");
+    exit(-1);
+  }
+  for (i = 0; i < n; i++)
+    mark[i] = -1;
+
+  for (s = 0; s < n; s++) {
+    if (placed[s])
+      continue;
+    /** Move the root to a vertex of least degree in the deepest level
+	while that makes the levels deeper */
+    root = s;
+    size = CuthillMcKeeLevels(graph,root,mark,stamp++,queue,&depth,&last);
+    for (tries = 0; tries < 8; tries++) {
+      next = queue[last];
+      for (i = last; i < size; i++)
+	if (VertexDegree(graph,queue[i]) < VertexDegree(graph,next))
+	  next = queue[i];
+      CuthillMcKeeLevels(graph,next,mark,stamp++,queue,&newdepth,&last);
+      if (newdepth <= depth)
+	break;
+      root = next;
+      depth = newdepth;
+    }
+    size = CuthillMcKeeLevels(graph,root,mark,stamp++,&order[count],&depth,&last);
+    for (i = count; i < count + size; i++)
+      placed[order[i]] = TRUE;
+    count += size;
+  }
+
+  for (i = 0; i < n/2; i++) {
+    s = order[i];
+    order[i] = order[n-1-i];
+    order[n-1-i] = s;
+  }
+  free(mark);
+  free(queue);
+  free(placed);
+}
+
+/**
+   CuthillMcKeeLevels lists the component of root in queue breadth
+   first, the new neighbours of each vertex in order of degree, marking
+   them with stamp. Returns the size of the component, with the number
+   of levels below root in depth and the first vertex of the last level
+   in last.
+*/
+int CuthillMcKeeLevels(GRAPH *graph, int root, int *mark, int stamp, int *queue,
+		       int *depth, int *last)
+{
+  int head = 0, tail = 0, levelend, i, j, a, k, v, m;
+
+  queue[tail++] = root;
+  mark[root] = stamp;
+  levelend = tail;
+  *depth = 0;
+  *last = 0;
+  while (head < tail) {
+    if (head == levelend) {
+      (*depth)++;
+      *last = head;
+      levelend = tail;
+    }
+    i = queue[head++];
+    k = tail;
+    for (a = (*graph).nbrstart[i]; a < (*graph).nbrstart[i+1]; a++) {
+      j = (*graph).nbr[a];
+      if (mark[j] != stamp) {
+	mark[j] = stamp;
+	queue[tail++] = j;
+      }
+    }
+    /** Insertion sort of the new vertices by degree */
+    for (v = k + 1; v < tail; v++) {
+      j = queue[v];
+      for (m = v; m > k && VertexDegree(graph,queue[m-1]) > VertexDegree(graph,j); m--)
+	queue[m] = queue[m-1];
+      queue[m] = j;
+    }
+  }
+  return(tail);
+}
+
+int VertexDegree(GRAPH *graph, int i)
+{
+  return((*graph).nbrstart[i+1] - (*graph).nbrstart[i]);
+}
+
+/** GraphBandwidth is the largest difference in number between neighbours */
+int GraphBandwidth(GRAPH *graph)
+{
+  int i, a, width = 0;
+
+  BuildNeighbourLists(graph);
+  for (i = 0; i < (*graph).nodes; i++)
+    for (a = (*graph).nbrstart[i]; a < (*graph).nbrstart[i+1]; a++)
+      if (abs((*graph).nbr[a] - i) > width)
+	width = abs((*graph).nbr[a] - i);
+  return(width);
+}
+
+/**
+   BenchmarkReorder compares the walk engines with the vertices as
+   read, shuffled (as a generator that numbers them arbitrarily would
+   leave them), and in reverse Cuthill-McKee order from the shuffled
+   graph. For each it prints the misses of a model cache of CACHESETS
+   sets of CACHEWAYS lines of CACHELINE bytes (a common L1 data cache)
+   in a step, and the measured time of a step. The fused row is
+   FusedStep, the step of QuantumWalk and QuantumSearch.
+*/
+void BenchmarkReorder(GRAPH *graph)
+{
+  QWPARAM param;
+  WALKBATCH batch;
+  MATDBL space = NULL;
+  QWWORKSPACE work;
+  int n = (*graph).nodes, arcs, pass, t, i, j, steps, peaktime, width[3], *shuffle, *position;
+  long misses[3][4];
+  double seconds[3][4], tstart, *amp, *next, *swap, *prob, **column, peak;
+  unsigned long long seed = QWHASHBASIS;
+  char *engine[4] = {"matrix","arcs","batch","fused"};
+
+  param.procedure = 'w';
+  param.start = 0;
+  param.marked = n;
+  BuildNeighbourLists(graph);
+  arcs = (*graph).nbrstart[n];
+  amp = malloc((arcs > 0 ? arcs : 1) * sizeof(double));
+  next = malloc((arcs > 0 ? arcs : 1) * sizeof(double));
+  shuffle = malloc((n > 0 ? n : 1) * sizeof(int));
+  position = malloc((n > 0 ? n : 1) * sizeof(int));
+  prob = malloc((n > 0 ? n : 1) * sizeof(double));
+  column = malloc((n > 0 ? n : 1) * sizeof(double *));
+  if (amp == NULL || next == NULL || shuffle == NULL || position == NULL || prob == NULL ||
+      column == NULL) {
+    fprintf(stderr,"BenchmarkReorder: Memory allocation failed.\n");
+    exit(-1);
+  }
+  for (i = 0; i < n; i++)
+    column[i] = &prob[i];
+  /** A Fisher-Yates shuffle from a fixed seed, the same every run */
+  for (i = 0; i < n; i++)
+    shuffle[i] = i;
+  for (i = n - 1; i > 0; i--) {
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    j = (int)((seed >> 33) % (i + 1));
+    t = shuffle[i];
+    shuffle[i] = shuffle[j];
+    shuffle[j] = t;
+  }
+
+  for (pass = 0; pass < 3; pass++) {
+    if (pass == 1) {
+      PermuteAdjacency(graph,shuffle);
+      FreeNeighbourLists(graph);
+    } else if (pass == 2)
+      ReorderGraph(graph,&param);
+    width[pass] = GraphBandwidth(graph);
+    misses[pass][0] = StepCacheMisses(graph,0);
+    misses[pass][1] = StepCacheMisses(graph,1);
+    misses[pass][2] = StepCacheMisses(graph,WALKLANES);
+    misses[pass][3] = FusedCacheMisses(graph);
+
+    steps = (n > 1000) ? 5 : 50;
+    MallocMatDbl(&space,n,n);
+    MallocWorkspace(&work,graph);
+    InitialiseSingleVertex(&space,graph,&param);
+    tstart = GetRunTime();
+    for (t = 0; t < steps; t++)
+      TranslationOperation(&space,graph,&work);
+    seconds[pass][0] = (GetRunTime() - tstart) / steps;
+    FreeWorkspace(&work);
+    FreeMatDbl(&space,n);
+
+    steps = (int)(2e7 / (arcs > 0 ? arcs : 1)) + 1;
+    tstart = GetRunTime();
+    SearchPeak(graph,0,steps,amp,next,&peak,&peaktime);
+    seconds[pass][1] = (GetRunTime() - tstart) / steps;
+
+    steps = steps / WALKLANES + 1;
+    MallocWalkBatch(&batch,graph);
+    BatchEqualSuperposition(&batch);
+    tstart = GetRunTime();
+    for (t = 0; t < steps; t++)
+      BatchStep(&batch);
+    seconds[pass][2] = (GetRunTime() - tstart) / steps;
+    FreeWalkBatch(&batch);
+
+    steps = (int)(2e7 / (arcs > 0 ? arcs : 1)) + 1;
+    ArcSingleVertex(graph,param.start,amp);
+    tstart = GetRunTime();
+    for (t = 0; t < steps; t++) {
+      FusedStep(graph,-1,amp,next,column,0);
+      swap = amp;
+      amp = next;
+      next = swap;
+    }
+    seconds[pass][3] = (GetRunTime() - tstart) / steps;
+  }
+
+  /** Undo the reordering and then the shuffle */
+  RestoreGraphOrder(graph,NULL,&param);
+  for (i = 0; i < n; i++)
+    position[shuffle[i]] = i;
+  PermuteAdjacency(graph,position);
+  FreeNeighbourLists(graph);
+  free(amp);
+  free(next);
+  free(shuffle);
+  free(position);
+  free(prob);
+  free(column);
+
+  fprintf(stderr,"BenchmarkReorder: %d vertices, %d arcs, bandwidth %d as read, %d shuffled, %d reordered\n",
+	  n,arcs,width[0],width[1],width[2]);
+  fprintf(stderr,"  model cache %d KB, %d-way, %d byte lines\n",
+	  CACHESETS*CACHEWAYS*CACHELINE/1024,CACHEWAYS,CACHELINE);
+  fprintf(stderr,"%8s %10s %10s %10s %11s %11s %11s\n","engine","misses","shuffled",
+	  "reordered","s/step","shuffled","reordered");
+  for (t = 0; t < 4; t++)
+    fprintf(stderr,"%8s %10ld %10ld %10ld %11.3e %11.3e %11.3e\n",engine[t],
+	    misses[0][t],misses[1][t],misses[2][t],seconds[0][t],seconds[1][t],seconds[2][t]);
+}
+
+/**
+   StepCacheMisses counts the misses of the model cache in a step of a
+   walk engine, after a first step to warm it. With lanes = 0 this is
+   the shift of TranslationOperation, each arc i -> j reading row j of
+   the copy of the space matrix and writing row i (the copy itself
+   flushes the cache every step, and is not counted). Otherwise there
+   are lanes doubles per arc, in order, as in SearchPeak (1) or a
+   WALKBATCH (WALKLANES), and the step is the coin, reading and writing
+   the arcs in order, then the shift, each arc reading the amplitude of
+   its reverse.
+*/
+long StepCacheMisses(GRAPH *graph, int lanes)
+{
+  CACHEMODEL cache;
+  int n = (*graph).nodes, arcs = (*graph).nbrstart[n], i, a, k, step;
+  unsigned long row, from, to, swap, bytes = lanes * sizeof(double);
+  long misses = 0;
+
+  memset(&cache,0,sizeof(CACHEMODEL));
+  row = ((unsigned long)n * sizeof(double) + CACHELINE - 1) / CACHELINE * CACHELINE;
+  from = 0;
+  to = (lanes == 0) ? row * n : (unsigned long)arcs * bytes;
+  to = (to + CACHELINE - 1) / CACHELINE * CACHELINE;
+  if (lanes == 0) {
+    for (i = 0; i < n; i++)
+      for (a = (*graph).nbrstart[i]; a < (*graph).nbrstart[i+1]; a++) {
+	CacheTouch(&cache,from + (*graph).nbr[a] * row + i * sizeof(double));
+	CacheTouch(&cache,to + i * row + (*graph).nbr[a] * sizeof(double));
+      }
+    return(cache.misses);
+  }
+  for (step = 0; step < 2; step++) {
+    misses = cache.misses;
+    for (a = 0; a < arcs; a++)
+      for (k = 0; k < lanes; k++)
+	CacheTouch(&cache,from + a * bytes + k * sizeof(double));
+    for (a = 0; a < arcs; a++) {
+      if ((*graph).reverse[a] < 0)
+	continue;
+      for (k = 0; k < lanes; k++) {
+	CacheTouch(&cache,from + (*graph).reverse[a] * bytes + k * sizeof(double));
+	CacheTouch(&cache,to + a * bytes + k * sizeof(double));
+      }
+    }
+    swap = from;
+    from = to;
+    to = swap;
+  }
+  return(cache.misses - misses);
+}
+
+/**
+   FusedCacheMisses counts the misses of the model cache in a
+   FusedStep, after a first step to warm it. Each vertex reads its arcs
+   in order, writes its probability, and writes each result to the
+   reverse arc of the next state.
+*/
+long FusedCacheMisses(GRAPH *graph)
+{
+  CACHEMODEL cache;
+  int n = (*graph).nodes, arcs = (*graph).nbrstart[n], i, a, step;
+  unsigned long from, to, prob, swap;
+  long misses = 0;
+
+  memset(&cache,0,sizeof(CACHEMODEL));
+  from = 0;
+  to = ((unsigned long)arcs * sizeof(double) + CACHELINE - 1) / CACHELINE * CACHELINE;
+  prob = 2 * to;
+  for (step = 0; step < 2; step++) {
+    misses = cache.misses;
+    for (i = 0; i < n; i++) {
+      for (a = (*graph).nbrstart[i]; a < (*graph).nbrstart[i+1]; a++)
+	CacheTouch(&cache,from + a * sizeof(double));
+      CacheTouch(&cache,prob + i * sizeof(double));
+      for (a = (*graph).nbrstart[i]; a < (*graph).nbrstart[i+1]; a++)
+	if ((*graph).reverse[a] >= 0)
+	  CacheTouch(&cache,to + (*graph).reverse[a] * sizeof(double));
+    }
+    swap = from;
+    from = to;
+    to = swap;
+  }
+  return(cache.misses - misses);
+}
+
+/** CacheTouch reads or writes address through the model LRU cache */
+void CacheTouch(CACHEMODEL *cache, unsigned long address)
+{
+  unsigned long line = address / CACHELINE;
+  int set = line % CACHESETS, way, oldest = 0;
+
+  (*cache).clock++;
+  for (way = 0; way < CACHEWAYS; way++) {
+    if ((*cache).used[set][way] != 0 && (*cache).tag[set][way] == line) {
+      (*cache).used[set][way] = (*cache).clock;
+      return;
+    }
+    if ((*cache).used[set][way] < (*cache).used[set][oldest])
+      oldest = way;
+  }
+  (*cache).misses++;
+  (*cache).tag[set][oldest] = line;
+  (*cache).used[set][oldest] = (*cache).clock;
+}
@@ -0,0 +1,389 @@
+/*=======================================================================
+   qwViz - OpenGL visualisation of quantum walks on graphs
+  -----------------------------------------------------------------------
+    Copyright (C) 2011 Scott D. Berry
+    Contact: scottdberry 'at' gmail
+
+    This file is part of qwViz.
+
+    qwViz is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qwViz is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qwViz.  If not, see <http://www.gnu.org/licenses/>.
+  ========================================================================*/
+#include "qwViz.h"
+
+/**
+   qw_spectrallayout.c is a native spectral layout, selected with
+   -spectral. Vertex i is drawn at (u2[i],u3[i]), where u2 and u3 are
+   the first two nontrivial solutions of the generalised eigenproblem
+   L u = lambda D u, L the Laplacian and D the degree matrix, as in
+   Koren (2003). The eigenvectors are found with block LOBPCG
+   (Knyazev 2001) on the neighbour lists, so each iteration costs
+   O(n + m). LOBPCG needs a good starting guess to converge quickly on
+   large graphs, so it is run on the coarsening hierarchy of
+   qw_forcelayout.c from the coarsest graph up, each level starting
+   from the eigenvectors of the one above.
+   ====================================================================
+*/
+
+extern OPTIONS options;
+
+/**
+   SpectralLayout positions the vertices of graph in Xcoord and Ycoord
+   from its Laplacian eigenvectors.
+*/
+void SpectralLayout(GRAPH *graph)
+{
+  LAYOUTLEVEL levels[FORCELEVELS];
+  int i, v, l, n, nlevels, iter;
+  unsigned int seed = 1;
+  double *x, *coarsex;
+
+  n = (*graph).nodes;
+  if (n <= SPECTRALBLOCK) {
+    for (i = 0; i < n; i++) {
+      (*graph).Xcoord[i] = cos(TWOPI * i / n);
+      (*graph).Ycoord[i] = sin(TWOPI * i / n);
+    }
+    return;
+  }
+  nlevels = BuildLayoutLevels(graph,levels,&seed);
+  while (nlevels > 1 && levels[nlevels-1].n <= SPECTRALBLOCK) {
+    nlevels--;
+    FreeLayoutLevel(&levels[nlevels]);
+  }
+
+  l = nlevels - 1;
+  coarsex = malloc(SPECTRALBLOCK * levels[l].n * sizeof(double));
+  if (coarsex == NULL) {
+    fprintf(stderr,"SpectralLayout: Memory allocation failed.\n");
+    exit(-1);
+  }
+  for (i = 0; i < SPECTRALBLOCK * levels[l].n; i++)
+    coarsex[i] = LayoutRandom(&seed) - 0.5;
+  iter = SpectralRefine(&levels[l],coarsex,SPECTRALCOARSEITER,&seed);
+  PublishLayoutLevel(levels,l,coarsex,coarsex + levels[l].n);
+  if (options.debug == TRUE)
+    fprintf(stderr,"SpectralLayout: %d vertices, %d iterations.\n",levels[l].n,iter);
+  for (l = nlevels - 2; l >= 0; l--) {
+    x = malloc(SPECTRALBLOCK * levels[l].n * sizeof(double));
+    if (x == NULL) {
+      fprintf(stderr,"SpectralLayout: Memory allocation failed.\n");
+      exit(-1);
+    }
+    for (v = 0; v < SPECTRALBLOCK; v++)
+      for (i = 0; i < levels[l].n; i++)
+	x[v * levels[l].n + i] = coarsex[v * levels[l+1].n + levels[l].coarse[i]];
+    free(coarsex);
+    coarsex = x;
+    iter = SpectralRefine(&levels[l],x,SPECTRALFINEITER,&seed);
+    PublishLayoutLevel(levels,l,x,x + levels[l].n);
+    if (options.debug == TRUE)
+      fprintf(stderr,"SpectralLayout: %d vertices, %d iterations.\n",levels[l].n,iter);
+    FreeLayoutLevel(&levels[l+1]);
+  }
+  for (i = 0; i < n; i++) {
+    (*graph).Xcoord[i] = coarsex[i];
+    (*graph).Ycoord[i] = coarsex[n + i];
+  }
+  free(coarsex);
+  free(levels[0].mass);
+  free(levels[0].coarse);
+}
+
+/**
+   SpectralRefine improves the SPECTRALBLOCK vectors in x (each n long,
+   one after the other) towards the lowest nontrivial eigenvectors of
+   L u = lambda D u for level, for at most maxiter iterations. Each
+   iteration is a Rayleigh-Ritz step over the current vectors, their
+   preconditioned residuals and the previous search directions. The
+   extra vector beyond the two needed speeds convergence when the
+   third and fourth eigenvalues are close. Returns the iterations used.
+*/
+int SpectralRefine(LAYOUTLEVEL *level, double *x, int maxiter, unsigned int *seed)
+{
+  int n = (*level).n, m = SPECTRALBLOCK, i, j, v, iter, ncols, np = 0;
+  double *deg, *s, *ls, *lx, *p, *g, *eval, *evec, *r;
+  double rnorm, worst;
+
+  deg = malloc(n * sizeof(double));
+  s = malloc(3 * m * n * sizeof(double));
+  ls = malloc(3 * m * n * sizeof(double));
+  lx = malloc(m * n * sizeof(double));
+  p = malloc(m * n * sizeof(double));
+  g = malloc(9 * m * m * sizeof(double));
+  eval = malloc(3 * m * sizeof(double));
+  evec = malloc(9 * m * m * sizeof(double));
+  if (deg == NULL || s == NULL || ls == NULL || lx == NULL || p == NULL ||
+      g == NULL || eval == NULL || evec == NULL) {
+    fprintf(stderr,"SpectralRefine: Memory allocation failed.\n");
+    exit(-1);
+  }
+  for (i = 0; i < n; i++) {
+    deg[i] = (*level).nbrstart[i+1] - (*level).nbrstart[i];
+    if (deg[i] <= 0)
+      deg[i] = 1;
+  }
+
+  /** The starting vectors, topped up at random if they are dependent */
+  memcpy(s,x,m * n * sizeof(double));
+  ncols = DOrthonormalise(s,0,m,n,deg);
+  while (ncols < m) {
+    for (i = 0; i < n; i++)
+      s[ncols * n + i] = LayoutRandom(seed) - 0.5;
+    ncols = DOrthonormalise(s,ncols,ncols + 1,n,deg);
+  }
+
+  for (iter = 0; iter < maxiter; iter++) {
+    LaplacianProduct(level,s,ls,ncols);
+
+    /** Rayleigh-Ritz: the columns of s are D-orthonormal, so this is
+	an ordinary symmetric eigenproblem for s^T L s */
+    for (i = 0; i < ncols; i++)
+      for (j = 0; j <= i; j++)
+	g[i * ncols + j] = g[j * ncols + i] = DotProduct(&s[i * n],&ls[j * n],n);
+    SymmetricEigen(g,ncols,eval,evec);
+
+    /** New search directions are the parts of the Ritz vectors outside
+	the old x, which are the first m columns of s */
+    np = 0;
+    if (ncols > m) {
+      np = m;
+      CombineColumns(&s[m * n],ncols - m,&evec[m * ncols],ncols,m,n,p);
+    }
+    CombineColumns(s,ncols,evec,ncols,m,n,x);
+    CombineColumns(ls,ncols,evec,ncols,m,n,lx);
+
+    /** Residuals r = L x - lambda D x, preconditioned by D^-1, go into
+	s after x. Converged once those of the wanted vectors are small
+	next to their eigenvalues. */
+    memcpy(s,x,m * n * sizeof(double));
+    worst = 0;
+    for (v = 0; v < m; v++) {
+      r = &s[(m + v) * n];
+      rnorm = 0;
+      for (i = 0; i < n; i++) {
+	r[i] = lx[v * n + i] - eval[v] * deg[i] * x[v * n + i];
+	rnorm += r[i] * r[i] / deg[i];
+	r[i] /= deg[i];
+      }
+      rnorm = sqrt(rnorm) / (fabs(eval[v]) > SPECTRALTOL ? fabs(eval[v]) : SPECTRALTOL);
+      if (v < 2 && rnorm > worst)
+	worst = rnorm;
+    }
+    if (worst < SPECTRALTOL)
+      break;
+    if (np > 0)
+      memcpy(&s[2 * m * n],p,np * n * sizeof(double));
+    ncols = DOrthonormalise(s,m,2 * m + np,n,deg);
+  }
+
+  free(deg);
+  free(s);
+  free(ls);
+  free(lx);
+  free(p);
+  free(g);
+  free(eval);
+  free(evec);
+  return(iter);
+}
+
+/**
+   DOrthonormalise makes columns first to last-1 of s orthonormal in
+   the inner product <a,b> = sum d_i a_i b_i, against the earlier
+   columns and the constant vector, which is the trivial eigenvector.
+   Columns that are (nearly) dependent are dropped and the rest moved
+   down. Gram-Schmidt is done twice for stability. Returns the number
+   of columns kept in all.
+*/
+int DOrthonormalise(double *s, int first, int last, int n, double *deg)
+{
+  int c, k, i, pass, kept = first;
+  double *a, *b, dot, norm, before, dsum = 0;
+
+  for (i = 0; i < n; i++)
+    dsum += deg[i];
+  for (c = first; c < last; c++) {
+    a = &s[kept * n];
+    if (kept != c)
+      memcpy(a,&s[c * n],n * sizeof(double));
+    before = sqrt(DDotProduct(a,a,deg,n));
+    for (pass = 0; pass < 2; pass++) {
+      dot = 0;
+      for (i = 0; i < n; i++)
+	dot += deg[i] * a[i];
+      dot /= dsum;
+      for (i = 0; i < n; i++)
+	a[i] -= dot;
+      for (k = 0; k < kept; k++) {
+	b = &s[k * n];
+	dot = DDotProduct(a,b,deg,n);
+	for (i = 0; i < n; i++)
+	  a[i] -= dot * b[i];
+      }
+    }
+    norm = sqrt(DDotProduct(a,a,deg,n));
+    if (norm <= 1e-10 * before || norm <= 0)
+      continue;
+    for (i = 0; i < n; i++)
+      a[i] /= norm;
+    kept++;
+  }
+  return(kept);
+}
+
+/**
+   LaplacianProduct sets the ncols columns of out to L times those of
+   in, dividing the vertices between threads.
+*/
+void LaplacianProduct(LAYOUTLEVEL *level, double *in, double *out, int ncols)
+{
+  SPECTRALPASS pass;
+
+  pass.level = level;
+  pass.in = in;
+  pass.out = out;
+  pass.ncols = ncols;
+  ParallelFor((*level).n,LaplacianRows,&pass);
+}
+
+/**
+   LaplacianRows is the work of LaplacianProduct for vertices start to
+   end-1: (L u)_i = d_i u_i - sum of u_j over the neighbours j.
+*/
+void LaplacianRows(int start, int end, void *arg)
+{
+  SPECTRALPASS *pass = arg;
+  LAYOUTLEVEL *level = (*pass).level;
+  int i, a, c, n = (*level).n;
+  double sum;
+
+  for (c = 0; c < (*pass).ncols; c++)
+    for (i = start; i < end; i++) {
+      sum = 0;
+      for (a = (*level).nbrstart[i]; a < (*level).nbrstart[i+1]; a++)
+	sum += (*pass).in[c * n + (*level).nbr[a]];
+      (*pass).out[c * n + i] = ((*level).nbrstart[i+1] - (*level).nbrstart[i])
+	* (*pass).in[c * n + i] - sum;
+    }
+}
+
+/**
+   CombineColumns sets the m columns of out (each n long) to the
+   combinations of the ncols columns of s given by the first m columns
+   of the row-major coefficient matrix c, whose rows are stride long.
+*/
+void CombineColumns(double *s, int ncols, double *c, int stride, int m, int n, double *out)
+{
+  int i, k, v;
+  double w;
+
+  for (v = 0; v < m; v++) {
+    for (i = 0; i < n; i++)
+      out[v * n + i] = 0;
+    for (k = 0; k < ncols; k++) {
+      w = c[k * stride + v];
+      for (i = 0; i < n; i++)
+	out[v * n + i] += w * s[k * n + i];
+    }
+  }
+}
+
+double DotProduct(double *a, double *b, int n)
+{
+  int i;
+  double sum = 0;
+
+  for (i = 0; i < n; i++)
+    sum += a[i] * b[i];
+  return(sum);
+}
+
+double DDotProduct(double *a, double *b, double *deg, int n)
+{
+  int i;
+  double sum = 0;
+
+  for (i = 0; i < n; i++)
+    sum += deg[i] * a[i] * b[i];
+  return(sum);
+}
+
+/**
+   SymmetricEigen finds the eigenvalues, ascending, and eigenvectors
+   (the columns of evec) of the symmetric k x k row-major matrix a, by
+   cyclic Jacobi rotations. a is destroyed. k is at most a few times
+   SPECTRALBLOCK, so the O(k^3) sweeps cost nothing next to the
+   products with L.
+*/
+void SymmetricEigen(double *a, int k, double *eval, double *evec)
+{
+  int i, j, r, sweep, best;
+  double off, theta, t, c, s, aij, air, ajr, swap;
+
+  for (i = 0; i < k; i++)
+    for (j = 0; j < k; j++)
+      evec[i * k + j] = (i == j);
+  for (sweep = 0; sweep < 100; sweep++) {
+    off = 0;
+    for (i = 0; i < k; i++)
+      for (j = i + 1; j < k; j++)
+	off += a[i * k + j] * a[i * k + j];
+    if (off < 1e-30)
+      break;
+    for (i = 0; i < k; i++)
+      for (j = i + 1; j < k; j++) {
+	aij = a[i * k + j];
+	if (fabs(aij) < 1e-300)
+	  continue;
+	theta = (a[j * k + j] - a[i * k + i]) / (2 * aij);
+	t = (theta >= 0 ? 1 : -1) / (fabs(theta) + sqrt(theta * theta + 1));
+	c = 1 / sqrt(t * t + 1);
+	s = t * c;
+	for (r = 0; r < k; r++) {
+	  air = a[i * k + r];
+	  ajr = a[j * k + r];
+	  a[i * k + r] = c * air - s * ajr;
+	  a[j * k + r] = s * air + c * ajr;
+	}
+	for (r = 0; r < k; r++) {
+	  air = a[r * k + i];
+	  ajr = a[r * k + j];
+	  a[r * k + i] = c * air - s * ajr;
+	  a[r * k + j] = s * air + c * ajr;
+	  air = evec[r * k + i];
+	  ajr = evec[r * k + j];
+	  evec[r * k + i] = c * air - s * ajr;
+	  evec[r * k + j] = s * air + c * ajr;
+	}
+      }
+  }
+
+  /** Sort into ascending order, columns of evec with them */
+  for (i = 0; i < k; i++)
+    eval[i] = a[i * k + i];
+  for (i = 0; i < k; i++) {
+    best = i;
+    for (j = i + 1; j < k; j++)
+      if (eval[j] < eval[best])
+	best = j;
+    if (best == i)
+      continue;
+    swap = eval[i]; eval[i] = eval[best]; eval[best] = swap;
+    for (r = 0; r < k; r++) {
+      swap = evec[r * k + i];
+      evec[r * k + i] = evec[r * k + best];
+      evec[r * k + best] = swap;
+    }
+  }
+}
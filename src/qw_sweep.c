@@ -0,0 +1,384 @@
+/*=======================================================================
+   qwViz - OpenGL visualisation of quantum walks on graphs
+  -----------------------------------------------------------------------
+    Copyright (C) 2011 Scott D. Berry
+    Contact: scottdberry 'at' gmail
+
+    This file is part of qwViz.
+
+    qwViz is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    qwViz is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with qwViz.  If not, see <http://www.gnu.org/licenses/>.
+  ========================================================================*/
+#include "qwViz.h"
+
+/**
+   qw_sweep.c runs the quantum-walk-based search once for each of a
+   list of marked vertices (-sweep all, or -sweep 1,5,10-20) and prints
+   a table of the highest probability of finding each marked vertex
+   and the step at which it is reached. All the searches share one copy
+   of the graph and are divided between threads.
+   Rather than the n x n space matrix of QuantumSearch, the amplitudes
+   are held one per arc, in the order of the neighbour lists, so each
+   search needs O(arcs) memory and time per step. The searches run
+   WALKLANES at a time in a WALKBATCH (qw_batch.c); SearchPeak, one
+   search at a time, is kept for comparison in BenchmarkWalk.
+   StartSweep does the same for walks from each of a list of start
+   vertices (-startsweep all, or a list), printing how much each walk
+   returns to its start, and with -o x.prob writing the walk from
+   vertex v to x_v.prob.
+   ====================================================================
+*/
+
+extern OPTIONS options;
+
+/**
+   SearchSweep runs the searches for the marked vertices listed in
+   qwparam.sweep and prints the table on stdout.
+*/
+void SearchSweep(GRAPH *graph, QWDATA *qwdata, QWPARAM *qwparam)
+{
+  SWEEPPASS pass;
+  int k, *listed, *position;
+  double tstart;
+
+  BuildNeighbourLists(graph);
+  pass.graph = graph;
+  pass.steps = (*qwdata).walksteps;
+  pass.count = ParseVertexList((*qwparam).sweep,(*graph).nodes,&listed);
+  pass.marked = malloc((pass.count > 0 ? pass.count : 1) * sizeof(int));
+  pass.peak = malloc((pass.count > 0 ? pass.count : 1) * sizeof(double));
+  pass.peaktime = malloc((pass.count > 0 ? pass.count : 1) * sizeof(int));
+  position = malloc((*graph).nodes * sizeof(int));
+  if (pass.marked == NULL || pass.peak == NULL || pass.peaktime == NULL || position == NULL) {
+    fprintf(stderr,"SearchSweep: Memory allocation failed.\n");
+    exit(-1);
+  }
+  /** The list is numbered as in the file, and the graph may not be */
+  for (k = 0; k < (*graph).nodes; k++)
+    position[((*graph).order != NULL) ? (*graph).order[k] : k] = k;
+  for (k = 0; k < pass.count; k++)
+    pass.marked[k] = position[listed[k]];
+  tstart = GetRunTime();
+  ParallelFor((pass.count + WALKLANES - 1) / WALKLANES,SweepRows,&pass);
+  if (options.debug == TRUE)
+    fprintf(stderr,"SearchSweep: %d searches of %d steps in %.3f seconds on %d threads.\n",
+	    pass.count,pass.steps,GetRunTime() - tstart,GetParallelThreads());
+
+  printf("# Search sweep of %d marked vertices, %d steps\n",pass.count,pass.steps);
+  printf("# %8s %16s %12s\n","marked","peak prob","peak step");
+  for (k = 0; k < pass.count; k++)
+    printf("%10d %16.10f %12d\n",listed[k] + 1,pass.peak[k],pass.peaktime[k]);
+
+  free(listed);
+  free(position);
+  free(pass.marked);
+  free(pass.peak);
+  free(pass.peaktime);
+}
+
+/**
+   SweepRows runs batches start to end-1 of the sweep, called from
+   ParallelFor. Batch b holds the searches b*WALKLANES onwards, and the
+   lanes of a short last batch are left unmarked and ignored.
+*/
+void SweepRows(int start, int end, void *arg)
+{
+  SWEEPPASS *pass = arg;
+  WALKBATCH batch;
+  int b, k, t, first, lanes;
+  double p;
+
+  MallocWalkBatch(&batch,(*pass).graph);
+  for (b = start; b < end; b++) {
+    first = b * WALKLANES;
+    lanes = (*pass).count - first;
+    if (lanes > WALKLANES)
+      lanes = WALKLANES;
+    for (k = 0; k < WALKLANES; k++)
+      batch.marked[k] = (k < lanes) ? (*pass).marked[first + k] : -1;
+    for (k = 0; k < lanes; k++) {
+      (*pass).peak[first + k] = -1;
+      (*pass).peaktime[first + k] = 0;
+    }
+    BatchEqualSuperposition(&batch);
+    for (t = 0; t < (*pass).steps; t++) {
+      for (k = 0; k < lanes; k++) {
+	p = BatchVertexProbability(&batch,k,batch.marked[k]);
+	if (p > (*pass).peak[first + k]) {
+	  (*pass).peak[first + k] = p;
+	  (*pass).peaktime[first + k] = t;
+	}
+      }
+      BatchStep(&batch);
+    }
+  }
+  FreeWalkBatch(&batch);
+}
+
+/**
+   StartSweep runs QuantumWalk from each of the start vertices listed
+   in qwparam.startsweep and prints a table on stdout of the mean
+   probability at the start over the walk, and the highest probability
+   of being back at the start after step 0 and its step. If an output
+   file x.prob is given, each walk is also written to x_start.prob as
+   WriteRawData would, every qwdata.stride steps.
+*/
+void StartSweep(GRAPH *graph, QWDATA *qwdata, QWPARAM *qwparam, QWFILE *qwfile)
+{
+  STARTPASS pass;
+  int k, size;
+  double tstart;
+
+  BuildNeighbourLists(graph);
+  pass.graph = graph;
+  pass.steps = (*qwdata).walksteps;
+  pass.stride = (*qwdata).stride;
+  pass.out = ((*qwparam).write == TRUE) ? (*qwfile).out : NULL;
+  pass.count = ParseVertexList((*qwparam).startsweep,(*graph).nodes,&pass.listed);
+  size = (pass.count > 0) ? pass.count : 1;
+  pass.start = malloc(size * sizeof(int));
+  pass.mean = malloc(size * sizeof(double));
+  pass.peak = malloc(size * sizeof(double));
+  pass.peaktime = malloc(size * sizeof(int));
+  pass.position = malloc((*graph).nodes * sizeof(int));
+  if (pass.start == NULL || pass.mean == NULL || pass.peak == NULL || pass.peaktime == NULL ||
+      pass.position == NULL) {
+    fprintf(stderr,"StartSweep: Memory allocation failed.\n");
+    exit(-1);
+  }
+  /** The list and the files are numbered as in the file, and the
+      graph may not be */
+  for (k = 0; k < (*graph).nodes; k++)
+    pass.position[((*graph).order != NULL) ? (*graph).order[k] : k] = k;
+  for (k = 0; k < pass.count; k++)
+    pass.start[k] = pass.position[pass.listed[k]];
+  tstart = GetRunTime();
+  ParallelFor((pass.count + WALKLANES - 1) / WALKLANES,StartRows,&pass);
+  if (options.debug == TRUE)
+    fprintf(stderr,"StartSweep: %d walks of %d steps in %.3f seconds on %d threads.\n",
+	    pass.count,pass.steps,GetRunTime() - tstart,GetParallelThreads());
+
+  printf("# Walk sweep of %d start vertices, %d steps\n",pass.count,pass.steps);
+  printf("# %8s %16s %16s %12s\n","start","mean at start","peak return","peak step");
+  for (k = 0; k < pass.count; k++)
+    printf("%10d %16.10f %16.10f %12d\n",pass.listed[k] + 1,pass.mean[k],pass.peak[k],
+	   pass.peaktime[k]);
+
+  free(pass.listed);
+  free(pass.position);
+  free(pass.start);
+  free(pass.mean);
+  free(pass.peak);
+  free(pass.peaktime);
+}
+
+/**
+   StartRows runs batches start to end-1 of a start sweep, called from
+   ParallelFor. Batch b holds the walks b*WALKLANES onwards; the lanes
+   of a short last batch repeat its first walk and are ignored.
+*/
+void StartRows(int start, int end, void *arg)
+{
+  STARTPASS *pass = arg;
+  GRAPH *graph = (*pass).graph;
+  WALKBATCH batch;
+  FILE *fptr[WALKLANES];
+  char name[512];
+  int b, k, t, v, first, lanes, n = (*graph).nodes, vertex[WALKLANES];
+  double p, *prob = NULL;
+
+  MallocWalkBatch(&batch,graph);
+  if ((*pass).out != NULL && (prob = malloc(n * WALKLANES * sizeof(double))) == NULL) {
+    fprintf(stderr,"StartRows: Memory allocation failed.\n");
+    exit(-1);
+  }
+  for (b = start; b < end; b++) {
+    first = b * WALKLANES;
+    lanes = (*pass).count - first;
+    if (lanes > WALKLANES)
+      lanes = WALKLANES;
+    for (k = 0; k < WALKLANES; k++)
+      vertex[k] = (*pass).start[first + ((k < lanes) ? k : 0)];
+    for (k = 0; k < lanes; k++) {
+      (*pass).mean[first + k] = 0.0;
+      (*pass).peak[first + k] = -1;
+      (*pass).peaktime[first + k] = 0;
+      fptr[k] = NULL;
+      if ((*pass).out == NULL)
+	continue;
+      StartFileName(pass,(*pass).listed[first + k],name,512);
+      if ((fptr[k] = fopen(name,"w")) == NULL)
+	fprintf(stderr,"StartRows: error opening output file %s\n",name);
+    }
+    BatchSingleVertex(&batch,vertex);
+    for (t = 0; t < (*pass).steps; t++) {
+      for (k = 0; k < lanes; k++) {
+	p = BatchVertexProbability(&batch,k,vertex[k]);
+	(*pass).mean[first + k] += p / (*pass).steps;
+	if (t > 0 && p > (*pass).peak[first + k]) {
+	  (*pass).peak[first + k] = p;
+	  (*pass).peaktime[first + k] = t;
+	}
+      }
+      if (prob != NULL && t % (*pass).stride == 0) {
+	BatchProbabilities(&batch,prob);
+	for (k = 0; k < lanes; k++) {
+	  if (fptr[k] == NULL)
+	    continue;
+	  for (v = 0; v < n; v++)
+	    fprintf(fptr[k],"%12.10f  ",prob[(*pass).position[v]*WALKLANES + k]);
+	  fprintf(fptr[k],"\n");
+	}
+      }
+      BatchStep(&batch);
+    }
+    for (k = 0; k < lanes; k++)
+      if ((*pass).out != NULL && fptr[k] != NULL)
+	fclose(fptr[k]);
+  }
+  free(prob);
+  FreeWalkBatch(&batch);
+}
+
+/**
+   StartFileName writes into name, of length size, the output file
+   x.prob with the start vertex (counting from 1) added, x_5.prob.
+*/
+void StartFileName(STARTPASS *pass, int listed, char *name, int size)
+{
+  char *ext = strrchr((*pass).out,'.');
+  int stem = (ext != NULL) ? (int)(ext - (*pass).out) : (int)strlen((*pass).out);
+
+  snprintf(name,size,"%.*s_%d%s",stem,(*pass).out,listed + 1,(ext != NULL) ? ext : "");
+}
+
+/**
+   SearchPeak is QuantumSearch for the marked vertex, with amplitudes
+   per arc in amp and next, only measuring the probability at the
+   marked vertex. The largest is returned in peak, and the first step
+   at which it occurs in peaktime.
+*/
+void SearchPeak(GRAPH *graph, int marked, int steps, double *amp, double *next,
+		double *peak, int *peaktime)
+{
+  int *nbrstart = (*graph).nbrstart, *reverse = (*graph).reverse;
+  int n = (*graph).nodes, i, a, t, d;
+  double p, sum, *swap;
+
+  /** The equal superposition of InitialiseEqualSuperposition */
+  for (i = 0; i < n; i++) {
+    d = nbrstart[i+1] - nbrstart[i];
+    for (a = nbrstart[i]; a < nbrstart[i+1]; a++)
+      amp[a] = sqrt(1.0/((double)d*n));
+  }
+  *peak = -1;
+  *peaktime = 0;
+  for (t = 0; t < steps; t++) {
+    p = 0.0;
+    for (a = nbrstart[marked]; a < nbrstart[marked+1]; a++)
+      p += amp[a]*amp[a];
+    if (p > *peak) {
+      *peak = p;
+      *peaktime = t;
+    }
+
+    /** Grover coin, -I at the marked vertex */
+    for (i = 0; i < n; i++) {
+      if (i == marked) {
+	for (a = nbrstart[i]; a < nbrstart[i+1]; a++)
+	  amp[a] = -amp[a];
+	continue;
+      }
+      d = nbrstart[i+1] - nbrstart[i];
+      if (d == 0)
+	continue;
+      sum = 0.0;
+      for (a = nbrstart[i]; a < nbrstart[i+1]; a++)
+	sum += amp[a];
+      sum *= 2.0/d;
+      for (a = nbrstart[i]; a < nbrstart[i+1]; a++)
+	amp[a] = sum - amp[a];
+    }
+
+    /** Shift: the arc i -> j takes the amplitude of j -> i */
+    for (a = 0; a < nbrstart[n]; a++)
+      next[a] = (reverse[a] >= 0) ? amp[reverse[a]] : 0.0;
+    swap = amp;
+    amp = next;
+    next = swap;
+  }
+}
+
+/**
+   ParseVertexList reads "all", or a comma separated list of vertex
+   numbers and ranges counting from 1 such as 1,5,10-20, into a new
+   array of vertex indices counting from 0. Returns the length.
+*/
+int ParseVertexList(char *list, int n, int **vertices)
+{
+  int count = 0, size = 16, first, last, v, used;
+  char *p = list;
+
+  if ((*vertices = malloc(size * sizeof(int))) == NULL) {
+    fprintf(stderr,"ParseVertexList: Memory allocation failed.\n");
+    exit(-1);
+  }
+  if (strcmp(list,"all") == 0) {
+    free(*vertices);
+    if ((*vertices = malloc((n > 0 ? n : 1) * sizeof(int))) == NULL) {
+      fprintf(stderr,"ParseVertexList: Memory allocation failed.\n");
+      exit(-1);
+    }
+    for (v = 0; v < n; v++)
+      (*vertices)[v] = v;
+    return(n);
+  }
+  while (*p != '\0') {
+    if (sscanf(p,"%d%n",&first,&used) != 1) {
+      fprintf(stderr,"ParseVertexList error: \"%s\" is not a list of vertices.\n",list);
+      exit(-1);
+    }
+    p += used;
+    last = first;
+    if (*p == '-') {
+      p++;
+      if (sscanf(p,"%d%n",&last,&used) != 1) {
+	fprintf(stderr,"ParseVertexList error: \"%s\" is not a list of vertices.\n",list);
+	exit(-1);
+      }
+      p += used;
+    }
+    if (first < 1 || last > n || first > last) {
+      fprintf(stderr,"ParseVertexList error: vertices %d to %d are not in 1 to %d.\n",
+	      first,last,n);
+      exit(-1);
+    }
+    for (v = first; v <= last; v++) {
+      if (count == size) {
+	size *= 2;
+	if ((*vertices = realloc(*vertices,size * sizeof(int))) == NULL) {
+	  fprintf(stderr,"ParseVertexList: Memory allocation failed.\n");
+	  exit(-1);
+	}
+      }
+      (*vertices)[count++] = v - 1;
+    }
+    if (*p == ',')
+      p++;
+    else if (*p != '\0') {
+      fprintf(stderr,"ParseVertexList error: \"%s\" is not a list of vertices.\n",list);
+      exit(-1);
+    }
+  }
+  return(count);
+}
@@ -91,6 +91,8 @@ int WriteQWML(GRAPH *graph, QWDATA *qwdata, QWFILE *qwfile)
     fprintf((*qwfile).fpout,"</vertex>\n");
   }
   fprintf((*qwfile).fpout,"</probdist>\n");
+  if ((*qwdata).stride > 1)
+    fprintf((*qwfile).fpout,"<stride>%d</stride>\n",(*qwdata).stride);
   fprintf((*qwfile).fpout,"<filename>%s</filename>\n",Trim((*qwfile).out));
   fprintf((*qwfile).fpout,"<comment>computed_by_qwViz</comment>\n");
   fprintf((*qwfile).fpout,"</qwml>\n");